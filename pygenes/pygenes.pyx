@@ -5,8 +5,29 @@
 from libcpp.string cimport string
 from libcpp cimport bool
 from libcpp.vector cimport vector
+from libcpp.utility cimport pair
+from libc.stdint cimport uint8_t, uint32_t, uint64_t
+from libc.string cimport memcpy
+from libc.limits cimport INT_MAX
+
+import numpy as np
+
+cdef extern from "IntervalTree/IntervalIndex.h":
+    ctypedef enum EIntervalEngine:
+        IntervalTreeEngine
+        FlatIntervalTreeEngine
+        NCListEngine
+        AIListEngine
+
 
 cdef extern from "genemodels.cpp":
+    ctypedef enum EGeneLocation:
+        IntronLocation
+    ctypedef enum ENearestDirection:
+        AnyNearestDirection
+        UpstreamNearestDirection
+        DownstreamNearestDirection
+    const char* GetGeneLocationName(EGeneLocation location) nogil
     cdef cppclass CRegion:
         int start
         int end
@@ -19,16 +40,57 @@ cdef extern from "genemodels.cpp":
         int start
         int end
     cdef cppclass CGeneModels:
-        void CGeneModels() except +
-        void LoadEnsemblGTF(string gtf_filename) except +
-        CGene GetGene(string geneID) except +
-        string GetTranscriptGene(string transcriptID) except +
-        void FindOverlappingGenes(string chromosome, int start, int end, vector[string] genes) except +
-        void FindContainedGenes(string chromosome, int start, int end, vector[string] genes) except +
-        void FindNearestGenes(string chromosome, int position, vector[string] genes) except +
-        string CalculateGeneLocation(string geneID, int position) except +
-        int CalculateGenomicPosition(string transcriptID, int position) except +
-        void CalculateGenomicRegions(string transcriptID, int start, int end, vector[CRegion]& regions) except +
+        void CGeneModels() except + nogil
+        void CGeneModels(EIntervalEngine interval_engine) except + nogil
+        void LoadEnsemblGTF(string gtf_filename) except + nogil
+        void LoadEnsemblGTF(string gtf_filename, bool memory_map, int num_threads) except + nogil
+        void SaveBinary(string binary_filename) except + nogil
+        void LoadBinary(string binary_filename) except + nogil
+        void SaveImage(string image_filename) except + nogil
+        void OpenImage(string image_filename) except + nogil
+        CGene GetGene(string geneID) except + nogil
+        string GetTranscriptGene(string transcriptID) except + nogil
+        unsigned int GetNumGenes() except + nogil
+        string GetGeneID(uint32_t geneOrdinal) except + nogil
+        uint32_t GetGeneOrdinal(string geneID) except + nogil
+        unsigned int GetNumChromosomes() except + nogil
+        string GetChromosomeName(int chromosomeID) except + nogil
+        int GetChromosomeID(string chromosome) except + nogil
+        void FindOverlappingGenes(string chromosome, int start, int end, vector[string] genes) except + nogil
+        void FindContainedGenes(string chromosome, int start, int end, vector[string] genes) except + nogil
+        void FindNearestGenes(string chromosome, int position, vector[string] genes) except + nogil
+        void FindOverlappingGeneOrdinals(string chromosome, int start, int end, vector[uint32_t] gene_ordinals) except + nogil
+        void FindContainedGeneOrdinals(string chromosome, int start, int end, vector[uint32_t] gene_ordinals) except + nogil
+        void FindNearestGeneOrdinals(string chromosome, int position, vector[uint32_t] gene_ordinals) except + nogil
+        void FindKNearestGenes(string chromosome, int position, size_t k, ENearestDirection direction, int maxDistance,
+                               vector[pair[string, int]] nearest) except + nogil
+        void FindKNearestGeneOrdinals(string chromosome, int position, size_t k, ENearestDirection direction, int maxDistance,
+                                      vector[pair[uint32_t, int]] nearest) except + nogil
+        size_t CountOverlappingGenes(string chromosome, int start, int end) except + nogil
+        size_t CountContainedGenes(string chromosome, int start, int end) except + nogil
+        bool AnyOverlappingGenes(string chromosome, int start, int end) except + nogil
+        void AnnotatePosition(string chromosome, int position, vector[uint32_t]& geneOrdinals, vector[EGeneLocation]& locations, int flank) except + nogil
+        string CalculateGeneLocation(string geneID, int position) except + nogil
+        int CalculateGenomicPosition(string transcriptID, int position) except + nogil
+        void CalculateGenomicRegions(string transcriptID, int start, int end, vector[CRegion]& regions) except + nogil
+        void FindOverlappingGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                         vector[uint64_t]& offsets, vector[uint32_t]& geneOrdinals, int numThreads) except + nogil
+        void FindContainedGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                       vector[uint64_t]& offsets, vector[uint32_t]& geneOrdinals, int numThreads) except + nogil
+        void FindNearestGeneOrdinals(const int* chromosomeIDs, const int* positions, size_t numQueries,
+                                     vector[uint64_t]& offsets, vector[uint32_t]& geneOrdinals, int numThreads) except + nogil
+        void AnnotatePositions(const int* chromosomeIDs, const int* positions, size_t numQueries, int flank,
+                               vector[uint64_t]& offsets, vector[uint32_t]& geneOrdinals, vector[EGeneLocation]& locations, int numThreads) except + nogil
+        void CountOverlappingGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                   uint32_t* counts, int numThreads) except + nogil
+        void CountContainedGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                 uint32_t* counts, int numThreads) except + nogil
+        void AnyOverlappingGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                 uint8_t* anyOverlapping, int numThreads) except + nogil
+        void CalculateGeneLocations(const uint32_t* geneOrdinals, const int* positions, size_t numQueries, EGeneLocation* locations, int numThreads) except + nogil
+        void JoinOverlappingGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+                                         vector[uint64_t]& queryIndices, vector[uint32_t]& geneOrdinals) except + nogil
+        void CalculateGenomicPositions(const vector[string]& transcriptIDs, const int* positions, int* genomicPositions, int numThreads) except + nogil
 
 
 cdef extern from "IntervalTree/IntervalTree.h":
@@ -37,10 +99,96 @@ cdef extern from "IntervalTree/IntervalTree.h":
         int stop
         T value
     cdef cppclass CIntervalTree[T]:
-        void CIntervalTree(vector[CInterval[T]] intervals) except +
-        void FindOverlapping(int start, int stop, vector[T] overlapping) except +
-        void FindContained(int start, int stop, vector[T] contained) except +
-        void FindNearest(int position, vector[T] nearest) except +
+        void CIntervalTree(vector[CInterval[T]] intervals) except + nogil
+        void FindOverlapping(int start, int stop, vector[T] overlapping) except + nogil
+        void FindContained(int start, int stop, vector[T] contained) except + nogil
+        void FindNearest(int position, vector[T] nearest) except + nogil
+        void FindKNearest(int position, size_t k, int maxDistance, vector[pair[T, int]] nearest) except + nogil
+        size_t CountOverlapping(int start, int stop) except + nogil
+        size_t CountContained(int start, int stop) except + nogil
+        bool AnyOverlapping(int start, int stop) except + nogil
+
+
+cdef extern from "IntervalTree/IntervalIndex.h":
+    cdef cppclass CIntervalIndex[T]:
+        void CIntervalIndex(vector[CInterval[T]] intervals, EIntervalEngine engine) except + nogil
+        void FindOverlapping(int start, int stop, vector[T] overlapping) except + nogil
+        void FindContained(int start, int stop, vector[T] contained) except + nogil
+        void FindNearest(int position, vector[T] nearest) except + nogil
+        void FindKNearest(int position, size_t k, int maxDistance, vector[pair[T, int]] nearest) except + nogil
+        size_t CountOverlapping(int start, int stop) except + nogil
+        size_t CountContained(int start, int stop) except + nogil
+        bool AnyOverlapping(int start, int stop) except + nogil
+
+
+cdef EIntervalEngine get_interval_engine(str engine) except *:
+    if engine == 'tree':
+        return IntervalTreeEngine
+    elif engine == 'flat':
+        return FlatIntervalTreeEngine
+    elif engine == 'nclist':
+        return NCListEngine
+    elif engine == 'ailist':
+        return AIListEngine
+    raise ValueError('unknown interval engine ' + engine)
+
+
+cdef ENearestDirection get_nearest_direction(str direction) except *:
+    if direction == 'any':
+        return AnyNearestDirection
+    elif direction == 'upstream':
+        return UpstreamNearestDirection
+    elif direction == 'downstream':
+        return DownstreamNearestDirection
+    raise ValueError('unknown nearest direction ' + direction)
+
+
+cdef int get_max_distance(max_distance) except *:
+    if max_distance is None:
+        return INT_MAX
+    return max_distance
+
+
+# Names of the gene location codes returned by batch queries
+gene_location_names = [GetGeneLocationName(<EGeneLocation>code) for code in range(IntronLocation + 1)]
+
+
+cdef const int* int_array_data(const int[::1] values) noexcept nogil:
+    return &values[0] if values.shape[0] > 0 else NULL
+
+
+cdef object uint64_array(const vector[uint64_t]& values):
+    result = np.empty(values.size(), dtype=np.uint64)
+    cdef uint64_t[::1] result_view = result
+    if values.size() > 0:
+        memcpy(&result_view[0], values.data(), values.size() * sizeof(uint64_t))
+    return result
+
+
+cdef object uint32_array(const vector[uint32_t]& values):
+    result = np.empty(values.size(), dtype=np.uint32)
+    cdef uint32_t[::1] result_view = result
+    if values.size() > 0:
+        memcpy(&result_view[0], values.data(), values.size() * sizeof(uint32_t))
+    return result
+
+
+cdef object locations_array(const EGeneLocation* locations, size_t size):
+    result = np.empty(size, dtype=np.uint8)
+    cdef uint8_t[::1] result_view = result
+    cdef size_t i
+    for i in range(size):
+        result_view[i] = <uint8_t>locations[i]
+    return result
+
+
+def as_int_array(values):
+    return np.ascontiguousarray(values, dtype=np.int32)
+
+
+def check_batch_sizes(*arrays):
+    if len(set(len(a) for a in arrays)) > 1:
+        raise ValueError('expected arrays of equal length')
 
 
 class Region:
@@ -61,9 +209,9 @@ class Gene:
 
 
 cdef class IntervalTree:
-    cdef CIntervalTree[int] *c_interval_tree
+    cdef CIntervalIndex[int] *c_interval_tree
 
-    def __cinit__(self, intervals):
+    def __cinit__(self, intervals, str engine='tree'):
         cdef CInterval[int] c_interval
         cdef vector[CInterval[int]] c_intervals = vector[CInterval[int]]()
 
@@ -77,70 +225,380 @@ cdef class IntervalTree:
 
             c_intervals.push_back(c_interval)
 
-        self.c_interval_tree = new CIntervalTree[int](c_intervals)
+        cdef EIntervalEngine c_engine = get_interval_engine(engine)
+        with nogil:
+            self.c_interval_tree = new CIntervalIndex[int](c_intervals, c_engine)
 
     def __dealloc__(self):
         del self.c_interval_tree
 
-    def find_overlapping(self, start, stop):
+    def find_overlapping(self, int start, int stop):
         cdef vector[int] overlapping
-        self.c_interval_tree.FindOverlapping(start, stop, overlapping)
+        with nogil:
+            self.c_interval_tree.FindOverlapping(start, stop, overlapping)
         return overlapping
 
-    def find_contained(self, start, stop):
+    def find_contained(self, int start, int stop):
         cdef vector[int] contained
-        self.c_interval_tree.FindContained(start, stop, contained)
+        with nogil:
+            self.c_interval_tree.FindContained(start, stop, contained)
         return contained
 
-    def find_nearest(self, position):
+    def find_nearest(self, int position):
         cdef vector[int] nearest
-        self.c_interval_tree.FindNearest(position, nearest)
+        with nogil:
+            self.c_interval_tree.FindNearest(position, nearest)
+        return nearest
+
+    def find_k_nearest(self, int position, size_t k, max_distance=None):
+        cdef int c_max_distance = get_max_distance(max_distance)
+        cdef vector[pair[int, int]] nearest
+        with nogil:
+            self.c_interval_tree.FindKNearest(position, k, c_max_distance, nearest)
         return nearest
 
+    def count_overlapping(self, int start, int stop):
+        cdef size_t count
+        with nogil:
+            count = self.c_interval_tree.CountOverlapping(start, stop)
+        return count
+
+    def count_contained(self, int start, int stop):
+        cdef size_t count
+        with nogil:
+            count = self.c_interval_tree.CountContained(start, stop)
+        return count
+
+    def any_overlapping(self, int start, int stop):
+        cdef bool any_overlapping
+        with nogil:
+            any_overlapping = self.c_interval_tree.AnyOverlapping(start, stop)
+        return any_overlapping
+
 
 cdef class GeneModels:
+    """ Gene models queried by gene, transcript and genomic position.  Queries,
+    save_binary and save_image release the gil and may be called concurrently from
+    any number of threads.  load_ensembl_gtf, load_binary and open_image replace the
+    model and keep the gil, so they do not overlap other calls from python threads.
+    """
     cdef CGeneModels *c_gene_models
 
-    def __cinit__(self):
-        self.c_gene_models = new CGeneModels()
+    def __cinit__(self, str interval_engine='tree'):
+        self.c_gene_models = new CGeneModels(get_interval_engine(interval_engine))
 
     def __dealloc__(self):
         del self.c_gene_models
 
-    def load_ensembl_gtf(self, str gtf_filename):
-        self.c_gene_models.LoadEnsemblGTF(gtf_filename)
+    def load_ensembl_gtf(self, str gtf_filename, bool memory_map=False, int num_threads=1):
+        cdef string c_gtf_filename = gtf_filename
+        self.c_gene_models.LoadEnsemblGTF(c_gtf_filename, memory_map, num_threads)
+
+    def save_binary(self, str binary_filename):
+        cdef string c_binary_filename = binary_filename
+        with nogil:
+            self.c_gene_models.SaveBinary(c_binary_filename)
+
+    def load_binary(self, str binary_filename):
+        cdef string c_binary_filename = binary_filename
+        self.c_gene_models.LoadBinary(c_binary_filename)
 
-    def get_gene(self, gene_id):
-        cdef CGene gene = self.c_gene_models.GetGene(gene_id)
+    def save_image(self, str image_filename):
+        cdef string c_image_filename = image_filename
+        with nogil:
+            self.c_gene_models.SaveImage(c_image_filename)
+
+    def open_image(self, str image_filename):
+        cdef string c_image_filename = image_filename
+        self.c_gene_models.OpenImage(c_image_filename)
+
+    def get_gene(self, string gene_id):
+        cdef CGene gene
+        with nogil:
+            gene = self.c_gene_models.GetGene(gene_id)
         return Gene(
             gene.id, gene.name, gene.source, gene.chromosome,
             gene.strand, gene.start, gene.end)
 
-    def get_transcript_gene(self, transcript_id):
-        return self.c_gene_models.GetTranscriptGene(transcript_id)
+    def get_transcript_gene(self, string transcript_id):
+        cdef string gene_id
+        with nogil:
+            gene_id = self.c_gene_models.GetTranscriptGene(transcript_id)
+        return gene_id
+
+    def get_num_genes(self):
+        return self.c_gene_models.GetNumGenes()
+
+    def get_gene_id(self, uint32_t gene_ordinal):
+        return self.c_gene_models.GetGeneID(gene_ordinal)
+
+    def get_gene_ordinal(self, string gene_id):
+        cdef uint32_t gene_ordinal
+        with nogil:
+            gene_ordinal = self.c_gene_models.GetGeneOrdinal(gene_id)
+        return gene_ordinal
 
-    def find_overlapping_genes(self, chromosome, start, end):
+    def get_num_chromosomes(self):
+        return self.c_gene_models.GetNumChromosomes()
+
+    def get_chromosome_name(self, int chromosome_id):
+        return self.c_gene_models.GetChromosomeName(chromosome_id)
+
+    def get_chromosome_id(self, string chromosome):
+        cdef int chromosome_id
+        with nogil:
+            chromosome_id = self.c_gene_models.GetChromosomeID(chromosome)
+        return chromosome_id
+
+    def find_overlapping_genes(self, string chromosome, int start, int end):
         cdef vector[string] genes
-        self.c_gene_models.FindOverlappingGenes(chromosome, start, end, genes)
+        with nogil:
+            self.c_gene_models.FindOverlappingGenes(chromosome, start, end, genes)
         return genes
 
-    def find_contained_genes(self, chromosome, start, end):
+    def find_contained_genes(self, string chromosome, int start, int end):
         cdef vector[string] genes
-        self.c_gene_models.FindContainedGenes(chromosome, start, end, genes)
+        with nogil:
+            self.c_gene_models.FindContainedGenes(chromosome, start, end, genes)
         return genes
 
-    def find_nearest_genes(self, chromosome, position):
+    def find_nearest_genes(self, string chromosome, int position):
         cdef vector[string] genes
-        self.c_gene_models.FindNearestGenes(chromosome, position, genes)
+        with nogil:
+            self.c_gene_models.FindNearestGenes(chromosome, position, genes)
         return genes
 
-    def calculate_gene_location(self, gene_id, position):
-        return self.c_gene_models.CalculateGeneLocation(gene_id, position)
+    def find_overlapping_gene_ordinals(self, string chromosome, int start, int end):
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindOverlappingGeneOrdinals(chromosome, start, end, gene_ordinals)
+        return gene_ordinals
+
+    def find_contained_gene_ordinals(self, string chromosome, int start, int end):
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindContainedGeneOrdinals(chromosome, start, end, gene_ordinals)
+        return gene_ordinals
+
+    def find_nearest_gene_ordinals(self, string chromosome, int position):
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindNearestGeneOrdinals(chromosome, position, gene_ordinals)
+        return gene_ordinals
+
+    def find_k_nearest_genes(self, string chromosome, int position, size_t k, str direction='any', max_distance=None):
+        cdef ENearestDirection c_direction = get_nearest_direction(direction)
+        cdef int c_max_distance = get_max_distance(max_distance)
+        cdef vector[pair[string, int]] nearest
+        with nogil:
+            self.c_gene_models.FindKNearestGenes(chromosome, position, k, c_direction, c_max_distance, nearest)
+        return nearest
 
-    def calculate_genomic_position(self, transcript_id, position):
-        return self.c_gene_models.CalculateGenomicPosition(transcript_id, position)
+    def find_k_nearest_gene_ordinals(self, string chromosome, int position, size_t k, str direction='any', max_distance=None):
+        cdef ENearestDirection c_direction = get_nearest_direction(direction)
+        cdef int c_max_distance = get_max_distance(max_distance)
+        cdef vector[pair[uint32_t, int]] nearest
+        with nogil:
+            self.c_gene_models.FindKNearestGeneOrdinals(chromosome, position, k, c_direction, c_max_distance, nearest)
+        return nearest
 
-    def calculate_genomic_regions(self, transcript_id, start, end):
+    def count_overlapping_genes(self, string chromosome, int start, int end):
+        cdef size_t count
+        with nogil:
+            count = self.c_gene_models.CountOverlappingGenes(chromosome, start, end)
+        return count
+
+    def count_contained_genes(self, string chromosome, int start, int end):
+        cdef size_t count
+        with nogil:
+            count = self.c_gene_models.CountContainedGenes(chromosome, start, end)
+        return count
+
+    def any_overlapping_genes(self, string chromosome, int start, int end):
+        cdef bool any_overlapping
+        with nogil:
+            any_overlapping = self.c_gene_models.AnyOverlappingGenes(chromosome, start, end)
+        return any_overlapping
+
+    def annotate_position(self, string chromosome, int position, int flank=0):
+        cdef vector[uint32_t] gene_ordinals
+        cdef vector[EGeneLocation] locations
+        with nogil:
+            self.c_gene_models.AnnotatePosition(chromosome, position, gene_ordinals, locations, flank)
+        return [(self.c_gene_models.GetGeneID(gene_ordinals[i]), GetGeneLocationName(locations[i]))
+                for i in range(gene_ordinals.size())]
+
+    def find_overlapping_gene_ordinals_batch(self, chromosome_ids, starts, ends, int num_threads=1):
+        """ Batch overlap query, returns (offsets, gene_ordinals), the genes of query i
+        being gene_ordinals[offsets[i]:offsets[i+1]]
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        cdef vector[uint64_t] offsets
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindOverlappingGeneOrdinals(
+                int_array_data(c_chromosome_ids), int_array_data(c_starts), int_array_data(c_ends),
+                c_chromosome_ids.shape[0], offsets, gene_ordinals, num_threads)
+        return uint64_array(offsets), uint32_array(gene_ordinals)
+
+    def find_contained_gene_ordinals_batch(self, chromosome_ids, starts, ends, int num_threads=1):
+        """ Batch contained query, returns (offsets, gene_ordinals) as for
+        find_overlapping_gene_ordinals_batch
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        cdef vector[uint64_t] offsets
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindContainedGeneOrdinals(
+                int_array_data(c_chromosome_ids), int_array_data(c_starts), int_array_data(c_ends),
+                c_chromosome_ids.shape[0], offsets, gene_ordinals, num_threads)
+        return uint64_array(offsets), uint32_array(gene_ordinals)
+
+    def find_nearest_gene_ordinals_batch(self, chromosome_ids, positions, int num_threads=1):
+        """ Batch nearest query, returns (offsets, gene_ordinals) as for
+        find_overlapping_gene_ordinals_batch
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_positions = as_int_array(positions)
+        check_batch_sizes(c_chromosome_ids, c_positions)
+        cdef vector[uint64_t] offsets
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.FindNearestGeneOrdinals(
+                int_array_data(c_chromosome_ids), int_array_data(c_positions),
+                c_chromosome_ids.shape[0], offsets, gene_ordinals, num_threads)
+        return uint64_array(offsets), uint32_array(gene_ordinals)
+
+    def count_overlapping_genes_batch(self, chromosome_ids, starts, ends, int num_threads=1):
+        """ Batch overlap count, returns the number of genes overlapping each query
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        result = np.empty(c_chromosome_ids.shape[0], dtype=np.uint32)
+        cdef uint32_t[::1] result_view = result
+        if c_chromosome_ids.shape[0] > 0:
+            with nogil:
+                self.c_gene_models.CountOverlappingGenes(
+                    &c_chromosome_ids[0], &c_starts[0], &c_ends[0],
+                    c_chromosome_ids.shape[0], &result_view[0], num_threads)
+        return result
+
+    def count_contained_genes_batch(self, chromosome_ids, starts, ends, int num_threads=1):
+        """ Batch contained count, returns the number of genes contained in each query
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        result = np.empty(c_chromosome_ids.shape[0], dtype=np.uint32)
+        cdef uint32_t[::1] result_view = result
+        if c_chromosome_ids.shape[0] > 0:
+            with nogil:
+                self.c_gene_models.CountContainedGenes(
+                    &c_chromosome_ids[0], &c_starts[0], &c_ends[0],
+                    c_chromosome_ids.shape[0], &result_view[0], num_threads)
+        return result
+
+    def any_overlapping_genes_batch(self, chromosome_ids, starts, ends, int num_threads=1):
+        """ Batch overlap existence, returns a boolean array, true for queries
+        overlapping any gene
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        result = np.empty(c_chromosome_ids.shape[0], dtype=np.bool_)
+        cdef uint8_t[::1] result_view = result.view(np.uint8)
+        if c_chromosome_ids.shape[0] > 0:
+            with nogil:
+                self.c_gene_models.AnyOverlappingGenes(
+                    &c_chromosome_ids[0], &c_starts[0], &c_ends[0],
+                    c_chromosome_ids.shape[0], &result_view[0], num_threads)
+        return result
+
+    def join_overlapping_gene_ordinals(self, chromosome_ids, starts, ends):
+        """ Join of regions against overlapping genes in a single sweep, returns
+        (query_indices, gene_ordinals) with a pair for each overlap
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_starts = as_int_array(starts)
+        cdef const int[::1] c_ends = as_int_array(ends)
+        check_batch_sizes(c_chromosome_ids, c_starts, c_ends)
+        cdef vector[uint64_t] query_indices
+        cdef vector[uint32_t] gene_ordinals
+        with nogil:
+            self.c_gene_models.JoinOverlappingGeneOrdinals(
+                int_array_data(c_chromosome_ids), int_array_data(c_starts), int_array_data(c_ends),
+                c_chromosome_ids.shape[0], query_indices, gene_ordinals)
+        return uint64_array(query_indices), uint32_array(gene_ordinals)
+
+    def annotate_positions_batch(self, chromosome_ids, positions, int flank=0, int num_threads=1):
+        """ Batch position annotation, returns (offsets, gene_ordinals, locations), the
+        genes of query i being gene_ordinals[offsets[i]:offsets[i+1]] with location
+        codes indexing gene_location_names
+        """
+        cdef const int[::1] c_chromosome_ids = as_int_array(chromosome_ids)
+        cdef const int[::1] c_positions = as_int_array(positions)
+        check_batch_sizes(c_chromosome_ids, c_positions)
+        cdef vector[uint64_t] offsets
+        cdef vector[uint32_t] gene_ordinals
+        cdef vector[EGeneLocation] locations
+        with nogil:
+            self.c_gene_models.AnnotatePositions(
+                int_array_data(c_chromosome_ids), int_array_data(c_positions),
+                c_chromosome_ids.shape[0], flank, offsets, gene_ordinals, locations, num_threads)
+        return uint64_array(offsets), uint32_array(gene_ordinals), locations_array(locations.data(), locations.size())
+
+    def calculate_gene_locations_batch(self, gene_ordinals, positions, int num_threads=1):
+        """ Batch gene location, returns location codes indexing gene_location_names
+        """
+        cdef const uint32_t[::1] c_gene_ordinals = np.ascontiguousarray(gene_ordinals, dtype=np.uint32)
+        cdef const int[::1] c_positions = as_int_array(positions)
+        check_batch_sizes(c_gene_ordinals, c_positions)
+        cdef size_t num_queries = c_gene_ordinals.shape[0]
+        cdef vector[EGeneLocation] locations = vector[EGeneLocation](num_queries)
+        if num_queries > 0:
+            with nogil:
+                self.c_gene_models.CalculateGeneLocations(
+                    &c_gene_ordinals[0], &c_positions[0], num_queries, locations.data(), num_threads)
+        return locations_array(locations.data(), num_queries)
+
+    def calculate_genomic_positions_batch(self, transcript_ids, positions, int num_threads=1):
+        """ Batch genomic position of positions in transcripts given by id
+        """
+        cdef vector[string] c_transcript_ids = transcript_ids
+        cdef const int[::1] c_positions = as_int_array(positions)
+        check_batch_sizes(transcript_ids, c_positions)
+        result = np.empty(c_positions.shape[0], dtype=np.int32)
+        cdef int[::1] result_view = result
+        if c_positions.shape[0] > 0:
+            with nogil:
+                self.c_gene_models.CalculateGenomicPositions(
+                    c_transcript_ids, &c_positions[0], &result_view[0], num_threads)
+        return result
+
+    def calculate_gene_location(self, string gene_id, int position):
+        cdef string location
+        with nogil:
+            location = self.c_gene_models.CalculateGeneLocation(gene_id, position)
+        return location
+
+    def calculate_genomic_position(self, string transcript_id, int position):
+        cdef int genomic_position
+        with nogil:
+            genomic_position = self.c_gene_models.CalculateGenomicPosition(transcript_id, position)
+        return genomic_position
+
+    def calculate_genomic_regions(self, string transcript_id, int start, int end):
         cdef vector[CRegion] regions
-        self.c_gene_models.CalculateGenomicRegions(transcript_id, start, end, regions)
+        with nogil:
+            self.c_gene_models.CalculateGenomicRegions(transcript_id, start, end, regions)
         return [Region(r.start, r.end) for r in regions]
@@ -6,11 +6,13 @@ import versioneer
 from setuptools import setup, find_packages, Extension
 
 
-libraries = []
-extra_compile_args = ['-g']
+libraries = ['z']
+extra_compile_args = ['-g', '-std=c++17']
 extra_link_args = ['-g']
 if 'linux' in sys.platform:
     libraries.append('rt')
+    extra_compile_args.append('-pthread')
+    extra_link_args.append('-pthread')
 elif sys.platform == 'darwin':
     extra_compile_args.extend(['-stdlib=libc++'])
     extra_link_args.extend(['-stdlib=libc++', '-mmacosx-version-min=10.9'])
@@ -24,6 +26,7 @@ if not os.path.exists('pygenes/pygenes.cpp'):
             ['pygenes/pygenes.pyx'],
             language='c++',
             include_dirs=['src'],
+            libraries=libraries,
             extra_compile_args=extra_compile_args,
             extra_link_args=extra_link_args,
         ),
@@ -38,6 +41,7 @@ else:
             ['pygenes/pygenes.cpp'],
             language='c++',
             include_dirs=['src'],
+            libraries=libraries,
             extra_compile_args=extra_compile_args,
             extra_link_args=extra_link_args,
         ),
@@ -53,5 +57,6 @@ setup(
     keywords=['bioinformatics'],
     classifiers=[],
     ext_modules=extensions,
+    install_requires=['numpy'],
 )
 
@@ -0,0 +1,127 @@
+#ifndef __BINARY_STREAM_H
+#define __BINARY_STREAM_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <cstring>
+#include <algorithm>
+
+#include <stdint.h>
+#include <zlib.h>
+
+using namespace std;
+
+
+// Append trivially copyable values, and size prefixed vectors of them, in
+// host byte order to a buffer
+class CBinaryWriter
+{
+public:
+	template <class T>
+	void Write(const T& value)
+	{
+		static_assert(is_trivially_copyable<T>::value, "raw write of non trivially copyable type");
+		mData.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	
+	// Write a size prefixed array of trivially copyable values
+	template <class T>
+	void WriteArray(const T* values, size_t size)
+	{
+		static_assert(is_trivially_copyable<T>::value, "raw write of non trivially copyable type");
+		Write<uint64_t>(size);
+		mData.append(reinterpret_cast<const char*>(values), size * sizeof(T));
+	}
+	
+	template <class T>
+	void Write(const vector<T>& values)
+	{
+		WriteArray(values.data(), values.size());
+	}
+	
+	const string& GetData() const
+	{
+		return mData;
+	}
+	
+private:
+	string mData;
+};
+
+
+// Read values written by CBinaryWriter, throwing if reads overrun the data
+class CBinaryReader
+{
+public:
+	CBinaryReader(string_view data) : mData(data), mOffset(0) {}
+	
+	template <class T>
+	void Read(T& value)
+	{
+		static_assert(is_trivially_copyable<T>::value, "raw read of non trivially copyable type");
+		memcpy(&value, Advance(sizeof(T)), sizeof(T));
+	}
+	
+	template <class T>
+	void Read(vector<T>& values)
+	{
+		static_assert(is_trivially_copyable<T>::value, "raw read of non trivially copyable type");
+		uint64_t size = ReadSize(sizeof(T));
+		values.resize(size);
+		memcpy(values.data(), Advance(size * sizeof(T)), size * sizeof(T));
+	}
+	
+	bool AtEnd() const
+	{
+		return mOffset == mData.size();
+	}
+	
+private:
+	// Read a container size, checking it against the remaining data given
+	// the minimum number of bytes per element
+	uint64_t ReadSize(size_t minElementSize)
+	{
+		uint64_t size;
+		Read(size);
+		if (size > (mData.size() - mOffset) / minElementSize)
+		{
+			throw std::out_of_range("binary data truncated");
+		}
+		return size;
+	}
+	
+	const char* Advance(size_t size)
+	{
+		if (size > mData.size() - mOffset)
+		{
+			throw std::out_of_range("binary data truncated");
+		}
+		const char* data = mData.data() + mOffset;
+		mOffset += size;
+		return data;
+	}
+	
+	string_view mData;
+	size_t mOffset;
+};
+
+
+// Crc32 of data of any size, in chunks that fit zlib's length type
+inline uint32_t CalculateCRC32(string_view data)
+{
+	uLong crc = crc32(0, Z_NULL, 0);
+	
+	const size_t maxChunk = 1 << 30;
+	for (size_t offset = 0; offset < data.size(); offset += maxChunk)
+	{
+		size_t chunkSize = min(maxChunk, data.size() - offset);
+		crc = crc32(crc, (const Bytef*)data.data() + offset, chunkSize);
+	}
+	
+	return crc;
+}
+
+#endif
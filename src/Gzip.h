@@ -0,0 +1,318 @@
+#ifndef __GZIP_H
+#define __GZIP_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <exception>
+#include <functional>
+
+#include <stdint.h>
+#include <zlib.h>
+
+using namespace std;
+
+
+// Gzip member header, as used by both plain gzip and BGZF
+const unsigned char GzipID1 = 0x1f;
+const unsigned char GzipID2 = 0x8b;
+const unsigned char GzipFlagExtra = 0x04;
+const size_t GzipHeaderSize = 10;
+const size_t GzipFooterSize = 8;
+
+// Largest uncompressed size of a BGZF block
+const size_t BGZFMaxContentsSize = 65536;
+
+// Largest ratio of uncompressed to compressed size deflate can achieve
+const size_t DeflateMaxRatio = 1032;
+
+
+inline bool IsGzip(string_view data)
+{
+	return data.size() >= 2 && (unsigned char)data[0] == GzipID1 && (unsigned char)data[1] == GzipID2;
+}
+
+
+inline unsigned int ReadLittleEndian(string_view data, size_t offset, size_t numBytes)
+{
+	unsigned int value = 0;
+	for (size_t byteIndex = 0; byteIndex < numBytes; byteIndex++)
+	{
+		value |= (unsigned int)(unsigned char)data[offset + byteIndex] << (8 * byteIndex);
+	}
+	return value;
+}
+
+
+// Size of the BGZF block at the start of data, or 0 if data does not start
+// with a complete BGZF block
+inline size_t GetBGZFBlockSize(string_view data)
+{
+	if (data.size() < GzipHeaderSize + 2 || !IsGzip(data) || !(data[3] & GzipFlagExtra))
+	{
+		return 0;
+	}
+	
+	size_t extraLength = ReadLittleEndian(data, GzipHeaderSize, 2);
+	if (data.size() < GzipHeaderSize + 2 + extraLength)
+	{
+		return 0;
+	}
+	
+	// Find the BC subfield holding the block size
+	size_t subfieldOffset = GzipHeaderSize + 2;
+	while (subfieldOffset + 4 <= GzipHeaderSize + 2 + extraLength)
+	{
+		size_t subfieldLength = ReadLittleEndian(data, subfieldOffset + 2, 2);
+		
+		if (data[subfieldOffset] == 'B' && data[subfieldOffset + 1] == 'C' && subfieldLength == 2)
+		{
+			size_t blockSize = ReadLittleEndian(data, subfieldOffset + 4, 2) + 1;
+			
+			if (blockSize < GzipHeaderSize + 2 + extraLength + GzipFooterSize || blockSize > data.size())
+			{
+				return 0;
+			}
+			
+			return blockSize;
+		}
+		
+		subfieldOffset += 4 + subfieldLength;
+	}
+	
+	return 0;
+}
+
+
+// Compressed and decompressed extents of a BGZF block
+struct CBGZFBlock
+{
+	size_t offset;
+	size_t size;
+	size_t contentsOffset;
+	size_t contentsSize;
+};
+
+
+// Split data into BGZF blocks, returning false if data is not entirely BGZF
+inline bool GetBGZFBlocks(string_view data, vector<CBGZFBlock>& blocks)
+{
+	size_t offset = 0;
+	size_t contentsOffset = 0;
+	while (offset < data.size())
+	{
+		size_t blockSize = GetBGZFBlockSize(data.substr(offset));
+		if (blockSize == 0)
+		{
+			return false;
+		}
+		
+		CBGZFBlock block;
+		block.offset = offset;
+		block.size = blockSize;
+		block.contentsOffset = contentsOffset;
+		block.contentsSize = ReadLittleEndian(data, offset + blockSize - 4, 4);
+		if (block.contentsSize > BGZFMaxContentsSize)
+		{
+			return false;
+		}
+		blocks.push_back(block);
+		
+		offset += blockSize;
+		contentsOffset += block.contentsSize;
+	}
+	
+	return true;
+}
+
+
+// Inflate the raw deflate payload of BGZF blocks [begin, end) into their
+// slots of contents
+inline void InflateBGZFBlocks(string_view data, const vector<CBGZFBlock>& blocks, size_t begin, size_t end,
+					   string& contents, exception_ptr& error)
+{
+	try
+	{
+		for (size_t blockIndex = begin; blockIndex < end; blockIndex++)
+		{
+			const CBGZFBlock& block = blocks[blockIndex];
+			
+			size_t extraLength = ReadLittleEndian(data, block.offset + GzipHeaderSize, 2);
+			size_t payloadOffset = block.offset + GzipHeaderSize + 2 + extraLength;
+			size_t payloadSize = block.offset + block.size - GzipFooterSize - payloadOffset;
+			
+			Bytef* blockContents = (Bytef*)&contents[0] + block.contentsOffset;
+			
+			z_stream stream = z_stream();
+			if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+			{
+				throw std::runtime_error("Unable to initialize zlib");
+			}
+			
+			stream.next_in = (Bytef*)data.data() + payloadOffset;
+			stream.avail_in = payloadSize;
+			stream.next_out = blockContents;
+			stream.avail_out = block.contentsSize;
+			
+			int result = inflate(&stream, Z_FINISH);
+			inflateEnd(&stream);
+			
+			unsigned int crc = ReadLittleEndian(data, block.offset + block.size - GzipFooterSize, 4);
+			
+			if (result != Z_STREAM_END || stream.avail_out != 0 ||
+				crc32(crc32(0, Z_NULL, 0), blockContents, block.contentsSize) != crc)
+			{
+				stringstream errorStr;
+				errorStr << "Corrupt BGZF block at offset " << block.offset;
+				throw std::runtime_error(errorStr.str());
+			}
+		}
+	}
+	catch (...)
+	{
+		error = current_exception();
+	}
+}
+
+
+// Decompress BGZF blocks on numThreads threads, each inflating a contiguous
+// range of blocks
+inline void DecompressBGZF(string_view data, const vector<CBGZFBlock>& blocks, string& contents, int numThreads)
+{
+	contents.resize(blocks.empty() ? 0 : blocks.back().contentsOffset + blocks.back().contentsSize);
+	
+	numThreads = max(1, min(numThreads, (int)blocks.size()));
+	
+	vector<exception_ptr> errors(numThreads);
+	
+	if (numThreads == 1)
+	{
+		InflateBGZFBlocks(data, blocks, 0, blocks.size(), contents, errors.front());
+	}
+	else
+	{
+		vector<thread> threads;
+		for (int threadIndex = 0; threadIndex < numThreads; threadIndex++)
+		{
+			size_t begin = blocks.size() * threadIndex / numThreads;
+			size_t end = blocks.size() * (threadIndex + 1) / numThreads;
+			threads.push_back(thread(InflateBGZFBlocks, data, cref(blocks), begin, end, ref(contents), ref(errors[threadIndex])));
+		}
+		for (vector<thread>::iterator threadIter = threads.begin(); threadIter != threads.end(); threadIter++)
+		{
+			threadIter->join();
+		}
+	}
+	
+	for (vector<exception_ptr>::const_iterator errorIter = errors.begin(); errorIter != errors.end(); errorIter++)
+	{
+		if (*errorIter)
+		{
+			rethrow_exception(*errorIter);
+		}
+	}
+}
+
+
+// Sequentially decompress gzip data made up of one or more members
+inline void DecompressGzipStream(string_view data, string& contents)
+{
+	z_stream stream = z_stream();
+	if (inflateInit2(&stream, MAX_WBITS + 16) != Z_OK)
+	{
+		throw std::runtime_error("Unable to initialize zlib");
+	}
+	
+	const size_t maxChunk = numeric_limits<uInt>::max();
+	
+	// Start from the size in the trailer of the last member, the exact size of
+	// single member contents under 4GiB, if deflate could reach it, growing
+	// by doubling for larger or concatenated contents
+	size_t initialSize = max((size_t)1024, data.size());
+	if (data.size() >= GzipHeaderSize + GzipFooterSize)
+	{
+		size_t trailerSize = ReadLittleEndian(data, data.size() - 4, 4);
+		if (trailerSize > initialSize && trailerSize / DeflateMaxRatio <= data.size())
+		{
+			initialSize = trailerSize;
+		}
+	}
+	contents.resize(initialSize);
+	
+	size_t inputOffset = 0;
+	size_t outputOffset = 0;
+	int result = Z_OK;
+	while (true)
+	{
+		if (stream.avail_in == 0)
+		{
+			if (inputOffset == data.size())
+			{
+				break;
+			}
+			
+			stream.next_in = (Bytef*)data.data() + inputOffset;
+			stream.avail_in = min(maxChunk, data.size() - inputOffset);
+			inputOffset += stream.avail_in;
+		}
+		
+		if (outputOffset == contents.size())
+		{
+			contents.resize(contents.size() * 2);
+		}
+		
+		stream.next_out = (Bytef*)&contents[0] + outputOffset;
+		stream.avail_out = min(maxChunk, contents.size() - outputOffset);
+		size_t availOut = stream.avail_out;
+		
+		result = inflate(&stream, Z_NO_FLUSH);
+		
+		outputOffset += availOut - stream.avail_out;
+		
+		if (result == Z_STREAM_END)
+		{
+			// Concatenated members are decompressed as a single stream
+			if (stream.avail_in == 0 && inputOffset == data.size())
+			{
+				break;
+			}
+			inflateReset(&stream);
+		}
+		else if (result != Z_OK && result != Z_BUF_ERROR)
+		{
+			inflateEnd(&stream);
+			throw std::runtime_error("Corrupt gzip data");
+		}
+	}
+	
+	inflateEnd(&stream);
+	
+	if (result != Z_STREAM_END)
+	{
+		throw std::runtime_error("Truncated gzip data");
+	}
+	
+	contents.resize(outputOffset);
+}
+
+
+// Decompress gzip data, inflating blocks in parallel for BGZF data
+inline void DecompressGzip(string_view data, string& contents, int numThreads = 1)
+{
+	vector<CBGZFBlock> blocks;
+	if (GetBGZFBlocks(data, blocks))
+	{
+		DecompressBGZF(data, blocks, contents, numThreads);
+	}
+	else
+	{
+		DecompressGzipStream(data, contents);
+	}
+}
+
+#endif
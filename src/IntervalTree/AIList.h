@@ -0,0 +1,371 @@
+#ifndef __AILIST_H
+#define __AILIST_H
+
+#include "IntervalTree.h"
+#include "IntervalScan.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+
+// Augmented interval list with the same query semantics as CIntervalTree.
+// Intervals are sorted by start and each is augmented with the maximum stop
+// of itself and all intervals before it.  Both are nondecreasing, so the
+// intervals that may overlap a query are a contiguous range, ending at the
+// last interval starting at or before the query stop and beginning at the
+// first with maximum stop at or after the query start.  Short ranges are
+// scanned back from their end, and ranges longer than a scan block are
+// bounded by binary search and scanned with the vectorized kernels.  Long
+// intervals covering many of the intervals after them would lengthen those
+// ranges, so they are moved to further components, each a separate sorted,
+// augmented list, all stored contiguously as start, stop, maximum stop and
+// value arrays.
+template <class T>
+class CAIList
+{
+public:
+	CAIList<T>() {}
+	
+	CAIList<T>(vector<CInterval<T> >& intervals,
+			   unsigned int coverageLength = 20,
+			   unsigned int minCoverage = 10,
+			   unsigned int minComponentSize = 64,
+			   unsigned int maxComponents = 10)
+	{
+		if (intervals.empty())
+		{
+			return;
+		}
+		
+		sort(intervals.begin(), intervals.end(), StartCmp<T>);
+		
+		mStarts.reserve(intervals.size());
+		mStops.reserve(intervals.size());
+		mMaxStops.reserve(intervals.size());
+		mValues.reserve(intervals.size());
+		
+		// Intervals covering at least minCoverage of the next coverageLength
+		// intervals are moved to the next component, stable so that each
+		// component remains in start order
+		vector<CInterval<T> > remaining(intervals);
+		vector<CInterval<T> > moved;
+		mComponentOffsets.push_back(0);
+		while (!remaining.empty())
+		{
+			bool last = remaining.size() <= minComponentSize || mComponentOffsets.size() == maxComponents;
+			
+			moved.clear();
+			int maxStop = remaining.front().stop;
+			for (unsigned int intervalIndex = 0; intervalIndex < remaining.size(); intervalIndex++)
+			{
+				const CInterval<T>& interval = remaining[intervalIndex];
+				if (!last && CountCovered(remaining, intervalIndex, coverageLength) >= minCoverage)
+				{
+					moved.push_back(interval);
+					continue;
+				}
+				
+				maxStop = max(maxStop, interval.stop);
+				mStarts.push_back(interval.start);
+				mStops.push_back(interval.stop);
+				mMaxStops.push_back(maxStop);
+				mValues.push_back(interval.value);
+			}
+			mComponentOffsets.push_back(mStarts.size());
+			
+			remaining.swap(moved);
+		}
+	}
+	
+	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
+	{
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mMaxStops[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mMaxStops.begin() + begin, mMaxStops.begin() + end - ScanBlockSize, start) - mMaxStops.begin();
+				AppendScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), mValues, begin, end, start, stop, overlapping);
+				continue;
+			}
+			
+			while (end > begin && mMaxStops[end - 1] >= start)
+			{
+				end--;
+				if (mStops[end] >= start)
+				{
+					overlapping.push_back(mValues[end]);
+				}
+			}
+		}
+	}
+	
+	void FindContained(int start, int stop, vector<T>& contained) const
+	{
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mStarts[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mStarts.begin() + begin, mStarts.begin() + end - ScanBlockSize, start) - mStarts.begin();
+				AppendScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), mValues, begin, end, start, stop, contained);
+				continue;
+			}
+			
+			while (end > begin && mStarts[end - 1] >= start)
+			{
+				end--;
+				if (mStops[end] <= stop)
+				{
+					contained.push_back(mValues[end]);
+				}
+			}
+		}
+	}
+	
+	size_t CountOverlapping(int start, int stop) const
+	{
+		size_t count = 0;
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mMaxStops[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mMaxStops.begin() + begin, mMaxStops.begin() + end - ScanBlockSize, start) - mMaxStops.begin();
+				count += CountScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), begin, end, start, stop);
+				continue;
+			}
+			
+			while (end > begin && mMaxStops[end - 1] >= start)
+			{
+				end--;
+				count += (mStops[end] >= start);
+			}
+		}
+		return count;
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		size_t count = 0;
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mStarts[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mStarts.begin() + begin, mStarts.begin() + end - ScanBlockSize, start) - mStarts.begin();
+				count += CountScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), begin, end, start, stop);
+				continue;
+			}
+			
+			while (end > begin && mStarts[end - 1] >= start)
+			{
+				end--;
+				count += (mStops[end] <= stop);
+			}
+		}
+		return count;
+	}
+	
+	// The maximum stop of the intervals starting at or before the query stop
+	// is at or after the query start only if one of them overlaps the query
+	bool AnyOverlapping(int start, int stop) const
+	{
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end > mComponentOffsets[componentIndex] && mMaxStops[end - 1] >= start)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	void FindNearest(int position, vector<T>& nearest) const
+	{
+		size_t nearestBegin = nearest.size();
+		FindOverlapping(position, position, nearest);
+		if (nearest.size() != nearestBegin)
+		{
+			return;
+		}
+		
+		// No interval contains position, so in each component those starting
+		// before it also end before it, and the nearest of them end at the
+		// maximum stop, found by scanning back while the maximum stop is
+		// unchanged.  The nearest after position start at the first start
+		// after it.
+		NearestAccumulator<T> nearestAccumulator;
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = mComponentOffsets[componentIndex + 1];
+			unsigned int after = FindStartsAfter(componentIndex, position);
+			
+			if (after > begin)
+			{
+				int maxStop = mMaxStops[after - 1];
+				for (unsigned int index = after; index > begin && mMaxStops[index - 1] == maxStop; index--)
+				{
+					if (mStops[index - 1] == maxStop)
+					{
+						nearestAccumulator.Add(position - maxStop, mValues[index - 1]);
+					}
+				}
+			}
+			
+			for (unsigned int index = after; index != end && mStarts[index] == mStarts[after]; index++)
+			{
+				nearestAccumulator.Add(mStarts[index] - position, mValues[index]);
+			}
+		}
+		nearest.insert(nearest.end(), nearestAccumulator.Get().begin(), nearestAccumulator.Get().end());
+	}
+	
+	// Call visitor(start, stop, value) for each interval overlapping [start,
+	// stop] until it returns false, returning false if it did
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mMaxStops[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mMaxStops.begin() + begin, mMaxStops.begin() + end - ScanBlockSize, start) - mMaxStops.begin();
+				if (!VisitScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), begin, end, start, stop, CIndexVisitor<T, TVisitor>(mStarts, mStops, mValues, visitor)))
+				{
+					return false;
+				}
+				continue;
+			}
+			
+			while (end > begin && mMaxStops[end - 1] >= start)
+			{
+				end--;
+				if (mStops[end] >= start && !visitor(mStarts[end], mStops[end], mValues[end]))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int begin = mComponentOffsets[componentIndex];
+			unsigned int end = FindStartsAfter(componentIndex, stop);
+			if (end - begin > ScanBlockSize && mStarts[end - ScanBlockSize] >= start)
+			{
+				begin = lower_bound(mStarts.begin() + begin, mStarts.begin() + end - ScanBlockSize, start) - mStarts.begin();
+				if (!VisitScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), begin, end, start, stop, CIndexVisitor<T, TVisitor>(mStarts, mStops, mValues, visitor)))
+				{
+					return false;
+				}
+				continue;
+			}
+			
+			while (end > begin && mStarts[end - 1] >= start)
+			{
+				end--;
+				if (mStops[end] <= stop && !visitor(mStarts[end], mStops[end], mValues[end]))
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		return VisitNearest<T>(*this, position, FindNearestDistance(position), visitor);
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, CAcceptAllIntervals(), nearest);
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, filter, nearest);
+	}
+	
+private:
+	// Distance of the nearest intervals to position, from the maximum stop
+	// before and first start after position in each component as for
+	// FindNearest, or the maximum int if there are none
+	int FindNearestDistance(int position) const
+	{
+		if (AnyOverlapping(position, position))
+		{
+			return 0;
+		}
+		
+		int distance = numeric_limits<int>::max();
+		for (unsigned int componentIndex = 0; componentIndex + 1 < mComponentOffsets.size(); componentIndex++)
+		{
+			unsigned int after = FindStartsAfter(componentIndex, position);
+			if (after > mComponentOffsets[componentIndex])
+			{
+				distance = min(distance, position - mMaxStops[after - 1]);
+			}
+			if (after < mComponentOffsets[componentIndex + 1])
+			{
+				distance = min(distance, mStarts[after] - position);
+			}
+		}
+		return distance;
+	}
+	
+	// Number of the coverageLength intervals following intervalIndex that
+	// end at or before it, and so are covered by it
+	static unsigned int CountCovered(const vector<CInterval<T> >& intervals, unsigned int intervalIndex, unsigned int coverageLength)
+	{
+		unsigned int covered = 0;
+		unsigned int end = min((unsigned int)intervals.size(), intervalIndex + 1 + coverageLength);
+		for (unsigned int nextIndex = intervalIndex + 1; nextIndex < end; nextIndex++)
+		{
+			if (intervals[nextIndex].stop <= intervals[intervalIndex].stop)
+			{
+				covered++;
+			}
+		}
+		return covered;
+	}
+	
+	// First interval of a component starting after position
+	unsigned int FindStartsAfter(unsigned int componentIndex, int position) const
+	{
+		return upper_bound(mStarts.begin() + mComponentOffsets[componentIndex], mStarts.begin() + mComponentOffsets[componentIndex + 1], position) - mStarts.begin();
+	}
+	
+	vector<int> mStarts;
+	vector<int> mStops;
+	vector<int> mMaxStops;
+	vector<T> mValues;
+	
+	// Intervals of component i are [mComponentOffsets[i], mComponentOffsets[i + 1])
+	vector<unsigned int> mComponentOffsets;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __ARRAY_VIEW_H
+#define __ARRAY_VIEW_H
+
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+
+// Non owning read only view of a contiguous array, such as the contents of
+// a vector or a section of a memory mapped file
+template <class T>
+class CArrayView
+{
+public:
+	typedef const T* const_iterator;
+	
+	CArrayView() : mData(0), mSize(0) {}
+	
+	CArrayView(const T* data, size_t size) : mData(data), mSize(size) {}
+	
+	CArrayView(const vector<T>& values) : mData(values.data()), mSize(values.size()) {}
+	
+	const T& operator[](size_t index) const
+	{
+		return mData[index];
+	}
+	
+	const T& front() const
+	{
+		return mData[0];
+	}
+	
+	const T& back() const
+	{
+		return mData[mSize - 1];
+	}
+	
+	const_iterator begin() const
+	{
+		return mData;
+	}
+	
+	const_iterator end() const
+	{
+		return mData + mSize;
+	}
+	
+	const T* data() const
+	{
+		return mData;
+	}
+	
+	size_t size() const
+	{
+		return mSize;
+	}
+	
+	bool empty() const
+	{
+		return mSize == 0;
+	}
+	
+	CArrayView<T> subview(size_t offset, size_t size) const
+	{
+		return CArrayView<T>(mData + offset, size);
+	}
+	
+private:
+	const T* mData;
+	size_t mSize;
+};
+
+#endif
@@ -0,0 +1,508 @@
+#ifndef __FLAT_INTERVAL_TREE_H
+#define __FLAT_INTERVAL_TREE_H
+
+#include "IntervalTree.h"
+#include "ArrayView.h"
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+// Node of a flat interval tree, addressing its children by node index and
+// its intervals as a range of the tree's interval array
+struct CFlatIntervalNode
+{
+	int center;
+	unsigned int intervalsBegin;
+	unsigned int intervalsEnd;
+	int left;
+	int right;
+};
+
+
+// Queries over the node and interval arrays of a flat interval tree, which
+// may be owned by a CFlatIntervalTree or mapped from a file
+template <class T>
+class CFlatIntervalTreeView
+{
+public:
+	CFlatIntervalTreeView<T>() {}
+	
+	CFlatIntervalTreeView<T>(CArrayView<CFlatIntervalNode> nodes, CArrayView<CInterval<T> > intervals)
+	: mNodes(nodes), mIntervals(intervals)
+	{}
+	
+	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
+	{
+		if (!mNodes.empty())
+		{
+			FindOverlapping(0, start, stop, overlapping);
+		}
+	}
+	
+	void FindContained(int start, int stop, vector<T>& contained) const
+	{
+		if (!mNodes.empty())
+		{
+			FindContained(0, start, stop, contained);
+		}
+	}
+	
+	void FindNearest(int position, vector<T>& nearest) const
+	{
+		NearestAccumulator<T> nearestAccumulator;
+		if (!mNodes.empty())
+		{
+			FindNearest(0, position, nearestAccumulator);
+		}
+		nearest.insert(nearest.end(), nearestAccumulator.Get().begin(), nearestAccumulator.Get().end());
+	}
+	
+	size_t CountOverlapping(int start, int stop) const
+	{
+		return mNodes.empty() ? 0 : CountOverlapping(0, start, stop);
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		return mNodes.empty() ? 0 : CountContained(0, start, stop);
+	}
+	
+	bool AnyOverlapping(int start, int stop) const
+	{
+		return !mNodes.empty() && AnyOverlapping(0, start, stop);
+	}
+	
+	// Call visitor(start, stop, value) for each interval overlapping [start,
+	// stop] until it returns false, returning false if it did
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		return mNodes.empty() || VisitOverlapping(0, start, stop, visitor);
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		return mNodes.empty() || VisitContained(0, start, stop, visitor);
+	}
+	
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		NearestDistanceAccumulator nearestDistance;
+		if (!mNodes.empty())
+		{
+			FindNearest(0, position, nearestDistance);
+		}
+		return VisitNearest<T>(*this, position, nearestDistance.GetDistance(), visitor);
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, CAcceptAllIntervals(), nearest);
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, filter, nearest);
+	}
+	
+	// Check that all node indices and interval ranges are in bounds, and
+	// that children follow their parent in preorder, which rules out cycles
+	bool IsValid() const
+	{
+		for (int nodeIndex = 0; nodeIndex < (int)mNodes.size(); nodeIndex++)
+		{
+			const CFlatIntervalNode& node = mNodes[nodeIndex];
+			if (node.intervalsBegin >= node.intervalsEnd || node.intervalsEnd > mIntervals.size() ||
+				(node.left >= 0 && (node.left <= nodeIndex || node.left >= (int)mNodes.size())) ||
+				(node.right >= 0 && (node.right <= nodeIndex || node.right >= (int)mNodes.size())))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	
+private:
+	void FindOverlapping(int nodeIndex, int start, int stop, vector<T>& overlapping) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				if (interval.stop >= start && interval.start <= stop)
+				{
+					overlapping.push_back(interval.value);
+				}
+			}
+		}
+		
+		if (node.left >= 0 && start <= node.center)
+		{
+			FindOverlapping(node.left, start, stop, overlapping);
+		}
+		
+		if (node.right >= 0 && stop >= node.center)
+		{
+			FindOverlapping(node.right, start, stop, overlapping);
+		}
+	}
+	
+	void FindContained(int nodeIndex, int start, int stop, vector<T>& contained) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				if (interval.start >= start && interval.stop <= stop)
+				{
+					contained.push_back(interval.value);
+				}
+			}
+		}
+		
+		if (node.left >= 0 && start <= node.center)
+		{
+			FindContained(node.left, start, stop, contained);
+		}
+		
+		if (node.right >= 0 && stop >= node.center)
+		{
+			FindContained(node.right, start, stop, contained);
+		}
+	}
+	
+	size_t CountOverlapping(int nodeIndex, int start, int stop) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		size_t count = 0;
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				count += (interval.stop >= start && interval.start <= stop);
+			}
+		}
+		
+		if (node.left >= 0 && start <= node.center)
+		{
+			count += CountOverlapping(node.left, start, stop);
+		}
+		
+		if (node.right >= 0 && stop >= node.center)
+		{
+			count += CountOverlapping(node.right, start, stop);
+		}
+		
+		return count;
+	}
+	
+	size_t CountContained(int nodeIndex, int start, int stop) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		size_t count = 0;
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				count += (interval.start >= start && interval.stop <= stop);
+			}
+		}
+		
+		if (node.left >= 0 && start <= node.center)
+		{
+			count += CountContained(node.left, start, stop);
+		}
+		
+		if (node.right >= 0 && stop >= node.center)
+		{
+			count += CountContained(node.right, start, stop);
+		}
+		
+		return count;
+	}
+	
+	bool AnyOverlapping(int nodeIndex, int start, int stop) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				if (interval.stop >= start && interval.start <= stop)
+				{
+					return true;
+				}
+			}
+		}
+		
+		return (node.left >= 0 && start <= node.center && AnyOverlapping(node.left, start, stop)) ||
+			   (node.right >= 0 && stop >= node.center && AnyOverlapping(node.right, start, stop));
+	}
+	
+	template <class TVisitor>
+	bool VisitOverlapping(int nodeIndex, int start, int stop, TVisitor& visitor) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				if (interval.stop >= start && interval.start <= stop && !visitor(interval.start, interval.stop, interval.value))
+				{
+					return false;
+				}
+			}
+		}
+		
+		return (node.left < 0 || start > node.center || VisitOverlapping(node.left, start, stop, visitor)) &&
+			   (node.right < 0 || stop < node.center || VisitOverlapping(node.right, start, stop, visitor));
+	}
+	
+	template <class TVisitor>
+	bool VisitContained(int nodeIndex, int start, int stop, TVisitor& visitor) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		if (stop >= mIntervals[node.intervalsBegin].start)
+		{
+			for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+			{
+				const CInterval<T>& interval = mIntervals[intervalIndex];
+				if (interval.start >= start && interval.stop <= stop && !visitor(interval.start, interval.stop, interval.value))
+				{
+					return false;
+				}
+			}
+		}
+		
+		return (node.left < 0 || start > node.center || VisitContained(node.left, start, stop, visitor)) &&
+			   (node.right < 0 || stop < node.center || VisitContained(node.right, start, stop, visitor));
+	}
+	
+	template <class TNearest>
+	void FindNearest(int nodeIndex, int position, TNearest& nearest) const
+	{
+		const CFlatIntervalNode& node = mNodes[nodeIndex];
+		
+		for (unsigned int intervalIndex = node.intervalsBegin; intervalIndex != node.intervalsEnd; intervalIndex++)
+		{
+			const CInterval<T>& interval = mIntervals[intervalIndex];
+			if (position < interval.start)
+			{
+				nearest.Add(interval.start - position, interval.value);
+			}
+			else if (position > interval.stop)
+			{
+				nearest.Add(position - interval.stop, interval.value);
+			}
+			else
+			{
+				nearest.Add(0, interval.value);
+			}
+		}
+		
+		if (node.left >= 0 && position < node.center)
+		{
+			FindNearest(node.left, position, nearest);
+		}
+		
+		if (node.right >= 0 && position > node.center)
+		{
+			FindNearest(node.right, position, nearest);
+		}
+	}
+	
+	CArrayView<CFlatIntervalNode> mNodes;
+	CArrayView<CInterval<T> > mIntervals;
+};
+
+
+// Interval tree with the same structure and query semantics as CIntervalTree,
+// stored as a single preorder array of nodes addressing their children by index.
+// The intervals of all nodes share a single pool, each node owning a contiguous
+// range of that pool.
+template <class T>
+class CFlatIntervalTree
+{
+public:
+	CFlatIntervalTree<T>() {}
+	
+	CFlatIntervalTree<T>(vector<CInterval<T> >& intervals,
+						unsigned int maxdepth = 16,
+						unsigned int minbucket = 64,
+						unsigned int maxbucket = 512)
+	{
+		if (intervals.empty())
+		{
+			return;
+		}
+		
+		sort(intervals.begin(), intervals.end(), StartCmp<T>);
+		
+		vector<unsigned int> order;
+		vector<unsigned int> scratch;
+		InitPartition(intervals, order, scratch);
+		
+		// Each node holds at least one interval, and there are at most
+		// 2^maxdepth - 1 nodes, so neither array is reallocated
+		unsigned int maxnodes = intervals.size();
+		if (maxdepth < 32)
+		{
+			maxnodes = min(maxnodes, (1u << maxdepth) - 1);
+		}
+		mNodes.reserve(maxnodes);
+		mIntervals.reserve(intervals.size());
+		
+		Construct(intervals, order, scratch, 0, order.size(), maxdepth, minbucket, maxbucket);
+	}
+	
+	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
+	{
+		GetView().FindOverlapping(start, stop, overlapping);
+	}
+	
+	void FindContained(int start, int stop, vector<T>& contained) const
+	{
+		GetView().FindContained(start, stop, contained);
+	}
+	
+	void FindNearest(int position, vector<T>& nearest) const
+	{
+		GetView().FindNearest(position, nearest);
+	}
+	
+	size_t CountOverlapping(int start, int stop) const
+	{
+		return GetView().CountOverlapping(start, stop);
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		return GetView().CountContained(start, stop);
+	}
+	
+	bool AnyOverlapping(int start, int stop) const
+	{
+		return GetView().AnyOverlapping(start, stop);
+	}
+	
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		return GetView().FindOverlapping(start, stop, visitor);
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		return GetView().FindContained(start, stop, visitor);
+	}
+	
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		return GetView().FindNearest(position, visitor);
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		GetView().FindKNearest(position, k, maxDistance, nearest);
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		GetView().FindKNearest(position, k, maxDistance, filter, nearest);
+	}
+	
+	CFlatIntervalTreeView<T> GetView() const
+	{
+		return CFlatIntervalTreeView<T>(mNodes, mIntervals);
+	}
+	
+	const vector<CFlatIntervalNode>& GetNodes() const
+	{
+		return mNodes;
+	}
+	
+	const vector<CInterval<T> >& GetIntervals() const
+	{
+		return mIntervals;
+	}
+	
+private:
+	int Construct(const vector<CInterval<T> >& intervals, vector<unsigned int>& order, vector<unsigned int>& scratch,
+				  unsigned int begin, unsigned int end, unsigned int depth, unsigned int minbucket, unsigned int maxbucket)
+	{
+		unsigned int size = end - begin;
+		
+		int nodeIndex = mNodes.size();
+		mNodes.push_back(CFlatIntervalNode());
+		
+		mNodes[nodeIndex].center = 0;
+		mNodes[nodeIndex].left = -1;
+		mNodes[nodeIndex].right = -1;
+		
+		unsigned int centersBegin = begin;
+		unsigned int centersEnd = end;
+		
+		if (!(depth == 1 || (size < minbucket && size < maxbucket)))
+		{
+			int center = intervals[order[begin + size / 2]].start;
+			mNodes[nodeIndex].center = center;
+			
+			PartitionIntervals(intervals, order, scratch, begin, end, center, centersBegin, centersEnd);
+		}
+		
+		mNodes[nodeIndex].intervalsBegin = mIntervals.size();
+		for (unsigned int orderIndex = centersBegin; orderIndex != centersEnd; orderIndex++)
+		{
+			mIntervals.push_back(intervals[order[orderIndex]]);
+		}
+		mNodes[nodeIndex].intervalsEnd = mIntervals.size();
+		
+		if (centersBegin != begin)
+		{
+			int left = Construct(intervals, order, scratch, begin, centersBegin, depth - 1, minbucket, maxbucket);
+			mNodes[nodeIndex].left = left;
+		}
+		if (centersEnd != end)
+		{
+			int right = Construct(intervals, order, scratch, centersEnd, end, depth - 1, minbucket, maxbucket);
+			mNodes[nodeIndex].right = right;
+		}
+		
+		return nodeIndex;
+	}
+	
+	vector<CFlatIntervalNode> mNodes;
+	vector<CInterval<T> > mIntervals;
+};
+
+#endif
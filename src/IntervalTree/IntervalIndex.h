@@ -0,0 +1,265 @@
+#ifndef __INTERVAL_INDEX_H
+#define __INTERVAL_INDEX_H
+
+#include "IntervalTree.h"
+#include "FlatIntervalTree.h"
+#include "NCList.h"
+#include "AIList.h"
+
+#include <vector>
+
+using namespace std;
+
+
+enum EIntervalEngine
+{
+	IntervalTreeEngine,
+	FlatIntervalTreeEngine,
+	NCListEngine,
+	AIListEngine
+};
+
+
+// Interval index backed by one of the interval engines, selected at
+// construction.  All engines return the same set of results for the same
+// queries, in an engine-dependent order.
+template <class T>
+class CIntervalIndex
+{
+public:
+	CIntervalIndex<T>() : mEngine(IntervalTreeEngine) {}
+	
+	CIntervalIndex<T>(vector<CInterval<T> >& intervals, EIntervalEngine engine = IntervalTreeEngine)
+	: mEngine(engine)
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree = CIntervalTree<T>(intervals);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree = CFlatIntervalTree<T>(intervals);
+			break;
+		case NCListEngine:
+			mNCList = CNCList<T>(intervals);
+			break;
+		case AIListEngine:
+			mAIList = CAIList<T>(intervals);
+			break;
+		}
+	}
+	
+	EIntervalEngine GetEngine() const
+	{
+		return mEngine;
+	}
+	
+	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree.FindOverlapping(start, stop, overlapping);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree.FindOverlapping(start, stop, overlapping);
+			break;
+		case NCListEngine:
+			mNCList.FindOverlapping(start, stop, overlapping);
+			break;
+		case AIListEngine:
+			mAIList.FindOverlapping(start, stop, overlapping);
+			break;
+		}
+	}
+	
+	void FindContained(int start, int stop, vector<T>& contained) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree.FindContained(start, stop, contained);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree.FindContained(start, stop, contained);
+			break;
+		case NCListEngine:
+			mNCList.FindContained(start, stop, contained);
+			break;
+		case AIListEngine:
+			mAIList.FindContained(start, stop, contained);
+			break;
+		}
+	}
+	
+	void FindNearest(int position, vector<T>& nearest) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree.FindNearest(position, nearest);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree.FindNearest(position, nearest);
+			break;
+		case NCListEngine:
+			mNCList.FindNearest(position, nearest);
+			break;
+		case AIListEngine:
+			mAIList.FindNearest(position, nearest);
+			break;
+		}
+	}
+	
+	size_t CountOverlapping(int start, int stop) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.CountOverlapping(start, stop);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.CountOverlapping(start, stop);
+		case NCListEngine:
+			return mNCList.CountOverlapping(start, stop);
+		case AIListEngine:
+			return mAIList.CountOverlapping(start, stop);
+		}
+		return 0;
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.CountContained(start, stop);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.CountContained(start, stop);
+		case NCListEngine:
+			return mNCList.CountContained(start, stop);
+		case AIListEngine:
+			return mAIList.CountContained(start, stop);
+		}
+		return 0;
+	}
+	
+	bool AnyOverlapping(int start, int stop) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.AnyOverlapping(start, stop);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.AnyOverlapping(start, stop);
+		case NCListEngine:
+			return mNCList.AnyOverlapping(start, stop);
+		case AIListEngine:
+			return mAIList.AnyOverlapping(start, stop);
+		}
+		return false;
+	}
+	
+	// Call visitor(start, stop, value) for each result until it returns
+	// false, returning false if it did
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.FindOverlapping(start, stop, visitor);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.FindOverlapping(start, stop, visitor);
+		case NCListEngine:
+			return mNCList.FindOverlapping(start, stop, visitor);
+		case AIListEngine:
+			return mAIList.FindOverlapping(start, stop, visitor);
+		}
+		return true;
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.FindContained(start, stop, visitor);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.FindContained(start, stop, visitor);
+		case NCListEngine:
+			return mNCList.FindContained(start, stop, visitor);
+		case AIListEngine:
+			return mAIList.FindContained(start, stop, visitor);
+		}
+		return true;
+	}
+	
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			return mIntervalTree.FindNearest(position, visitor);
+		case FlatIntervalTreeEngine:
+			return mFlatIntervalTree.FindNearest(position, visitor);
+		case NCListEngine:
+			return mNCList.FindNearest(position, visitor);
+		case AIListEngine:
+			return mAIList.FindNearest(position, visitor);
+		}
+		return true;
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree.FindKNearest(position, k, maxDistance, nearest);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree.FindKNearest(position, k, maxDistance, nearest);
+			break;
+		case NCListEngine:
+			mNCList.FindKNearest(position, k, maxDistance, nearest);
+			break;
+		case AIListEngine:
+			mAIList.FindKNearest(position, k, maxDistance, nearest);
+			break;
+		}
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		switch (mEngine)
+		{
+		case IntervalTreeEngine:
+			mIntervalTree.FindKNearest(position, k, maxDistance, filter, nearest);
+			break;
+		case FlatIntervalTreeEngine:
+			mFlatIntervalTree.FindKNearest(position, k, maxDistance, filter, nearest);
+			break;
+		case NCListEngine:
+			mNCList.FindKNearest(position, k, maxDistance, filter, nearest);
+			break;
+		case AIListEngine:
+			mAIList.FindKNearest(position, k, maxDistance, filter, nearest);
+			break;
+		}
+	}
+	
+private:
+	EIntervalEngine mEngine;
+	CIntervalTree<T> mIntervalTree;
+	CFlatIntervalTree<T> mFlatIntervalTree;
+	CNCList<T> mNCList;
+	CAIList<T> mAIList;
+};
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef __INTERVAL_SCAN_H
+#define __INTERVAL_SCAN_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define INTERVAL_SCAN_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+
+// Kernels scanning intervals stored as separate start and stop arrays, in
+// blocks of at most ScanBlockSize intervals.  The between kernel sets bit i
+// of masks for each interval with lower[i] >= minLower and upper[i] <=
+// maxUpper, which with lower the stops and upper the starts is an overlap
+// test, and with lower the starts and upper the stops a containment test.
+// The distance kernel writes the distance of each interval from a position
+// and returns the minimum distance.
+const size_t ScanBlockSize = 256;
+
+enum EScanLevel
+{
+	ScalarScan,
+	SSE41Scan,
+	AVX2Scan,
+	AVX512Scan
+};
+
+struct CScanKernels
+{
+	EScanLevel level;
+	const char* name;
+	void (*between)(const int* lower, const int* upper, size_t size, int minLower, int maxUpper, uint64_t* masks);
+	int (*distances)(const int* starts, const int* stops, size_t size, int position, int* distances);
+};
+
+
+inline void ScanBetweenScalar(const int* lower, const int* upper, size_t size, int minLower, int maxUpper, uint64_t* masks)
+{
+	fill(masks, masks + (size + 63) / 64, 0);
+	for (size_t index = 0; index < size; index++)
+	{
+		if (lower[index] >= minLower && upper[index] <= maxUpper)
+		{
+			masks[index / 64] |= (uint64_t)1 << (index % 64);
+		}
+	}
+}
+
+inline int ScanDistancesScalar(const int* starts, const int* stops, size_t size, int position, int* distances)
+{
+	int minDistance = numeric_limits<int>::max();
+	for (size_t index = 0; index < size; index++)
+	{
+		distances[index] = max(0, max(starts[index] - position, position - stops[index]));
+		minDistance = min(minDistance, distances[index]);
+	}
+	return minDistance;
+}
+
+
+#ifdef INTERVAL_SCAN_X86
+
+__attribute__((target("sse4.1")))
+inline void ScanBetweenSSE41(const int* lower, const int* upper, size_t size, int minLower, int maxUpper, uint64_t* masks)
+{
+	fill(masks, masks + (size + 63) / 64, 0);
+	__m128i minLowers = _mm_set1_epi32(minLower);
+	__m128i maxUppers = _mm_set1_epi32(maxUpper);
+	size_t index = 0;
+	for (; index + 4 <= size; index += 4)
+	{
+		__m128i outside = _mm_or_si128(_mm_cmpgt_epi32(minLowers, _mm_loadu_si128((const __m128i*)(lower + index))),
+									   _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(upper + index)), maxUppers));
+		uint64_t mask = ~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf;
+		masks[index / 64] |= mask << (index % 64);
+	}
+	for (; index < size; index++)
+	{
+		if (lower[index] >= minLower && upper[index] <= maxUpper)
+		{
+			masks[index / 64] |= (uint64_t)1 << (index % 64);
+		}
+	}
+}
+
+__attribute__((target("sse4.1")))
+inline int ScanDistancesSSE41(const int* starts, const int* stops, size_t size, int position, int* distances)
+{
+	__m128i positions = _mm_set1_epi32(position);
+	__m128i minDistances = _mm_set1_epi32(numeric_limits<int>::max());
+	size_t index = 0;
+	for (; index + 4 <= size; index += 4)
+	{
+		__m128i before = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(starts + index)), positions);
+		__m128i after = _mm_sub_epi32(positions, _mm_loadu_si128((const __m128i*)(stops + index)));
+		__m128i blockDistances = _mm_max_epi32(_mm_setzero_si128(), _mm_max_epi32(before, after));
+		_mm_storeu_si128((__m128i*)(distances + index), blockDistances);
+		minDistances = _mm_min_epi32(minDistances, blockDistances);
+	}
+	minDistances = _mm_min_epi32(minDistances, _mm_shuffle_epi32(minDistances, _MM_SHUFFLE(1, 0, 3, 2)));
+	minDistances = _mm_min_epi32(minDistances, _mm_shuffle_epi32(minDistances, _MM_SHUFFLE(2, 3, 0, 1)));
+	int minDistance = _mm_cvtsi128_si32(minDistances);
+	return min(minDistance, ScanDistancesScalar(starts + index, stops + index, size - index, position, distances + index));
+}
+
+__attribute__((target("avx2")))
+inline void ScanBetweenAVX2(const int* lower, const int* upper, size_t size, int minLower, int maxUpper, uint64_t* masks)
+{
+	fill(masks, masks + (size + 63) / 64, 0);
+	__m256i minLowers = _mm256_set1_epi32(minLower);
+	__m256i maxUppers = _mm256_set1_epi32(maxUpper);
+	size_t index = 0;
+	for (; index + 8 <= size; index += 8)
+	{
+		__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(minLowers, _mm256_loadu_si256((const __m256i*)(lower + index))),
+										  _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(upper + index)), maxUppers));
+		uint64_t mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+		masks[index / 64] |= mask << (index % 64);
+	}
+	for (; index < size; index++)
+	{
+		if (lower[index] >= minLower && upper[index] <= maxUpper)
+		{
+			masks[index / 64] |= (uint64_t)1 << (index % 64);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+inline int ScanDistancesAVX2(const int* starts, const int* stops, size_t size, int position, int* distances)
+{
+	__m256i positions = _mm256_set1_epi32(position);
+	__m256i minDistances = _mm256_set1_epi32(numeric_limits<int>::max());
+	size_t index = 0;
+	for (; index + 8 <= size; index += 8)
+	{
+		__m256i before = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(starts + index)), positions);
+		__m256i after = _mm256_sub_epi32(positions, _mm256_loadu_si256((const __m256i*)(stops + index)));
+		__m256i blockDistances = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_max_epi32(before, after));
+		_mm256_storeu_si256((__m256i*)(distances + index), blockDistances);
+		minDistances = _mm256_min_epi32(minDistances, blockDistances);
+	}
+	__m128i halfMinDistances = _mm_min_epi32(_mm256_castsi256_si128(minDistances), _mm256_extracti128_si256(minDistances, 1));
+	halfMinDistances = _mm_min_epi32(halfMinDistances, _mm_shuffle_epi32(halfMinDistances, _MM_SHUFFLE(1, 0, 3, 2)));
+	halfMinDistances = _mm_min_epi32(halfMinDistances, _mm_shuffle_epi32(halfMinDistances, _MM_SHUFFLE(2, 3, 0, 1)));
+	int minDistance = _mm_cvtsi128_si32(halfMinDistances);
+	return min(minDistance, ScanDistancesScalar(starts + index, stops + index, size - index, position, distances + index));
+}
+
+__attribute__((target("avx512f")))
+inline void ScanBetweenAVX512(const int* lower, const int* upper, size_t size, int minLower, int maxUpper, uint64_t* masks)
+{
+	fill(masks, masks + (size + 63) / 64, 0);
+	__m512i minLowers = _mm512_set1_epi32(minLower);
+	__m512i maxUppers = _mm512_set1_epi32(maxUpper);
+	for (size_t index = 0; index < size; index += 16)
+	{
+		__mmask16 valid = (size - index >= 16) ? 0xffff : (__mmask16)((1u << (size - index)) - 1);
+		__mmask16 mask = _mm512_mask_cmpge_epi32_mask(valid, _mm512_maskz_loadu_epi32(valid, lower + index), minLowers);
+		mask = _mm512_mask_cmple_epi32_mask(mask, _mm512_maskz_loadu_epi32(valid, upper + index), maxUppers);
+		masks[index / 64] |= (uint64_t)mask << (index % 64);
+	}
+}
+
+__attribute__((target("avx512f")))
+inline int ScanDistancesAVX512(const int* starts, const int* stops, size_t size, int position, int* distances)
+{
+	// Masked max with an explicit source and a scalar reduction, as gcc's
+	// unmasked max and min reduction read undefined vectors and warn
+	__m512i zeros = _mm512_setzero_si512();
+	__m512i positions = _mm512_set1_epi32(position);
+	__m512i minDistances = _mm512_set1_epi32(numeric_limits<int>::max());
+	for (size_t index = 0; index < size; index += 16)
+	{
+		__mmask16 valid = (size - index >= 16) ? 0xffff : (__mmask16)((1u << (size - index)) - 1);
+		__m512i before = _mm512_sub_epi32(_mm512_maskz_loadu_epi32(valid, starts + index), positions);
+		__m512i after = _mm512_sub_epi32(positions, _mm512_maskz_loadu_epi32(valid, stops + index));
+		__m512i blockDistances = _mm512_mask_max_epi32(zeros, valid, zeros, _mm512_mask_max_epi32(zeros, valid, before, after));
+		_mm512_mask_storeu_epi32(distances + index, valid, blockDistances);
+		minDistances = _mm512_mask_min_epi32(minDistances, valid, minDistances, blockDistances);
+	}
+	
+	int laneDistances[16];
+	_mm512_storeu_si512(laneDistances, minDistances);
+	return *min_element(laneDistances, laneDistances + 16);
+}
+
+#endif
+
+
+// Kernels for a level, which must be supported by the cpu
+inline CScanKernels GetScanKernels(EScanLevel level)
+{
+	CScanKernels kernels = {ScalarScan, "scalar", ScanBetweenScalar, ScanDistancesScalar};
+#ifdef INTERVAL_SCAN_X86
+	switch (level)
+	{
+	case AVX512Scan:
+		kernels = {AVX512Scan, "avx512", ScanBetweenAVX512, ScanDistancesAVX512};
+		break;
+	case AVX2Scan:
+		kernels = {AVX2Scan, "avx2", ScanBetweenAVX2, ScanDistancesAVX2};
+		break;
+	case SSE41Scan:
+		kernels = {SSE41Scan, "sse4.1", ScanBetweenSSE41, ScanDistancesSSE41};
+		break;
+	case ScalarScan:
+		break;
+	}
+#endif
+	return kernels;
+}
+
+// Highest scan level supported by the cpu
+inline EScanLevel GetSupportedScanLevel()
+{
+#ifdef INTERVAL_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return AVX512Scan;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return AVX2Scan;
+	}
+	if (__builtin_cpu_supports("sse4.1"))
+	{
+		return SSE41Scan;
+	}
+#endif
+	return ScalarScan;
+}
+
+// Kernels of the highest supported level, selected on first use
+inline const CScanKernels& GetScanKernels()
+{
+	static const CScanKernels kernels = GetScanKernels(GetSupportedScanLevel());
+	return kernels;
+}
+
+
+// Append values[i] for each interval i in [begin, end) with lower[i] >=
+// minLower and upper[i] <= maxUpper
+template <class T>
+void AppendScanBetween(const CScanKernels& kernels, const int* lower, const int* upper, const vector<T>& values, size_t begin, size_t end,
+					   int minLower, int maxUpper, vector<T>& result)
+{
+	uint64_t masks[ScanBlockSize / 64];
+	for (size_t blockBegin = begin; blockBegin < end; blockBegin += ScanBlockSize)
+	{
+		size_t blockSize = min(ScanBlockSize, end - blockBegin);
+		kernels.between(lower + blockBegin, upper + blockBegin, blockSize, minLower, maxUpper, masks);
+		for (size_t maskIndex = 0; maskIndex < (blockSize + 63) / 64; maskIndex++)
+		{
+			for (uint64_t mask = masks[maskIndex]; mask != 0; mask &= mask - 1)
+			{
+				result.push_back(values[blockBegin + maskIndex * 64 + __builtin_ctzll(mask)]);
+			}
+		}
+	}
+}
+
+// Call visit(i) in order for each interval i in [begin, end) with lower[i]
+// >= minLower and upper[i] <= maxUpper until it returns false, returning
+// false if it did
+template <class TVisit>
+bool VisitScanBetween(const CScanKernels& kernels, const int* lower, const int* upper, size_t begin, size_t end,
+					  int minLower, int maxUpper, TVisit visit)
+{
+	uint64_t masks[ScanBlockSize / 64];
+	for (size_t blockBegin = begin; blockBegin < end; blockBegin += ScanBlockSize)
+	{
+		size_t blockSize = min(ScanBlockSize, end - blockBegin);
+		kernels.between(lower + blockBegin, upper + blockBegin, blockSize, minLower, maxUpper, masks);
+		for (size_t maskIndex = 0; maskIndex < (blockSize + 63) / 64; maskIndex++)
+		{
+			for (uint64_t mask = masks[maskIndex]; mask != 0; mask &= mask - 1)
+			{
+				if (!visit(blockBegin + maskIndex * 64 + __builtin_ctzll(mask)))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Number of intervals i in [begin, end) with lower[i] >= minLower and
+// upper[i] <= maxUpper
+inline size_t CountScanBetween(const CScanKernels& kernels, const int* lower, const int* upper, size_t begin, size_t end,
+							   int minLower, int maxUpper)
+{
+	size_t count = 0;
+	uint64_t masks[ScanBlockSize / 64];
+	for (size_t blockBegin = begin; blockBegin < end; blockBegin += ScanBlockSize)
+	{
+		size_t blockSize = min(ScanBlockSize, end - blockBegin);
+		kernels.between(lower + blockBegin, upper + blockBegin, blockSize, minLower, maxUpper, masks);
+		for (size_t maskIndex = 0; maskIndex < (blockSize + 63) / 64; maskIndex++)
+		{
+			count += __builtin_popcountll(masks[maskIndex]);
+		}
+	}
+	return count;
+}
+
+// Whether any interval i in [begin, end) has lower[i] >= minLower and
+// upper[i] <= maxUpper, stopping at the first block with one
+inline bool AnyScanBetween(const CScanKernels& kernels, const int* lower, const int* upper, size_t begin, size_t end,
+						   int minLower, int maxUpper)
+{
+	uint64_t masks[ScanBlockSize / 64];
+	for (size_t blockBegin = begin; blockBegin < end; blockBegin += ScanBlockSize)
+	{
+		size_t blockSize = min(ScanBlockSize, end - blockBegin);
+		kernels.between(lower + blockBegin, upper + blockBegin, blockSize, minLower, maxUpper, masks);
+		for (size_t maskIndex = 0; maskIndex < (blockSize + 63) / 64; maskIndex++)
+		{
+			if (masks[maskIndex] != 0)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Add the nearest of the size intervals to nearest, skipping blocks with
+// no interval as near as those already added
+template <class T, class TNearest>
+void AddScanNearest(const CScanKernels& kernels, const int* starts, const int* stops, const vector<T>& values, size_t size,
+					int position, TNearest& nearest)
+{
+	int distances[ScanBlockSize];
+	for (size_t blockBegin = 0; blockBegin < size; blockBegin += ScanBlockSize)
+	{
+		size_t blockSize = min(ScanBlockSize, size - blockBegin);
+		int minDistance = kernels.distances(starts + blockBegin, stops + blockBegin, blockSize, position, distances);
+		if (minDistance <= nearest.GetDistance())
+		{
+			for (size_t index = 0; index < blockSize; index++)
+			{
+				if (distances[index] == minDistance)
+				{
+					nearest.Add(minDistance, values[blockBegin + index]);
+				}
+			}
+		}
+	}
+}
+
+#endif
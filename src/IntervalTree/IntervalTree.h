@@ -5,6 +5,13 @@
 #include <algorithm>
 #include <iostream>
 #include <limits>
+#include <functional>
+#include <utility>
+#include <cstdlib>
+
+#include <stdint.h>
+
+#include "IntervalScan.h"
 
 using namespace std;
 
@@ -74,22 +81,279 @@ public:
 		return mNearestValues;
 	}
 	
+	int GetDistance() const
+	{
+		return mNearestDistance;
+	}
+	
 private:
 	int mNearestDistance;
 	vector<T> mNearestValues;
 };
 
+// Nearest distance only, found before visiting the intervals at that
+// distance
+class NearestDistanceAccumulator
+{
+public:
+	NearestDistanceAccumulator() : mNearestDistance(numeric_limits<int>::max()) {}
+	
+	template <class T>
+	void Add(int distance, const T&)
+	{
+		mNearestDistance = min(mNearestDistance, distance);
+	}
+	
+	int GetDistance() const
+	{
+		return mNearestDistance;
+	}
+	
+private:
+	int mNearestDistance;
+};
+
+// Call visitor(start, stop, value) for each interval of an index at the
+// nearest distance from position until it returns false, returning false
+// if it did.  The intervals at that distance are those overlapping the
+// range of positions within it that contain position or end at either
+// end of the range.
+template <class T, class TIndex, class TVisitor>
+bool VisitNearest(const TIndex& index, int position, int distance, TVisitor& visitor)
+{
+	if (distance == numeric_limits<int>::max())
+	{
+		return true;
+	}
+	
+	// The window and distances can exceed int for positions far from the
+	// intervals, so are computed in 64 bits
+	int64_t windowStart = max<int64_t>(numeric_limits<int>::min(), (int64_t)position - distance);
+	int64_t windowStop = min<int64_t>(numeric_limits<int>::max(), (int64_t)position + distance);
+	
+	return index.FindOverlapping((int)windowStart, (int)windowStop, [&](int start, int stop, const T& value)
+	{
+		return max<int64_t>(0, max((int64_t)start - position, (int64_t)position - stop)) != distance || visitor(start, stop, value);
+	});
+}
+
+// Signed distance from position to an interval, negative for intervals
+// ending before position, positive for intervals starting after it and 0
+// for intervals containing it
+inline int SignedDistance(int start, int stop, int position)
+{
+	if (stop < position)
+	{
+		return stop - position;
+	}
+	return max(0, start - position);
+}
+
+// Order of (value, signed distance) pairs by absolute distance, then
+// intervals before position first, then by value
+template <class T>
+bool NearerCmp(const pair<T, int>& a, const pair<T, int>& b)
+{
+	if (abs(a.second) != abs(b.second))
+	{
+		return abs(a.second) < abs(b.second);
+	}
+	if (a.second != b.second)
+	{
+		return a.second < b.second;
+	}
+	return a.first < b.first;
+}
+
+// Filter of FindKNearestIntervals accepting every interval
+struct CAcceptAllIntervals
+{
+	template <class T>
+	bool operator()(int, int, const T&, int) const
+	{
+		return true;
+	}
+};
+
+// Append up to k (value, signed distance) pairs of the intervals of an index
+// nearest to position, at most maxDistance from it and accepted by
+// filter(start, stop, value, signedDistance), in NearerCmp order.  Starting
+// from the distance of the nearest interval, rings of doubling radius around
+// position are searched until k intervals are found, each interval being
+// accepted only in the ring holding its distance, so every interval nearer
+// than the last ring's radius is seen once and ties are broken consistently.
+template <class T, class TIndex, class TFilter>
+void FindKNearestIntervals(const TIndex& index, int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest)
+{
+	if (k == 0 || maxDistance < 0)
+	{
+		return;
+	}
+	
+	bool anyNearest = false;
+	int64_t outerRadius = 0;
+	index.FindNearest(position, [&](int start, int stop, const T&)
+	{
+		anyNearest = true;
+		outerRadius = abs(SignedDistance(start, stop, position));
+		return false;
+	});
+	if (!anyNearest || outerRadius > maxDistance)
+	{
+		return;
+	}
+	
+	size_t nearestBegin = nearest.size();
+	int64_t innerRadius = -1;
+	while (true)
+	{
+		// Intervals with a distance in (innerRadius, outerRadius], those
+		// before or containing position overlapping the left window and
+		// those after it overlapping the right window
+		auto accept = [&](int start, int stop, const T& value)
+		{
+			int distance = SignedDistance(start, stop, position);
+			if (abs(distance) > innerRadius && abs(distance) <= outerRadius && filter(start, stop, value, distance))
+			{
+				nearest.push_back(make_pair(value, distance));
+			}
+			return true;
+		};
+		
+		int64_t leftStart = max<int64_t>(numeric_limits<int>::min(), position - outerRadius);
+		int64_t leftStop = position - innerRadius - 1;
+		if (leftStop >= leftStart)
+		{
+			index.FindOverlapping((int)leftStart, (int)leftStop, accept);
+		}
+		
+		int64_t rightStart = position + max<int64_t>(innerRadius, 0) + 1;
+		int64_t rightStop = min<int64_t>(numeric_limits<int>::max(), position + outerRadius);
+		if (rightStop >= rightStart)
+		{
+			index.FindOverlapping((int)rightStart, (int)rightStop, [&](int start, int stop, const T& value)
+			{
+				// Intervals containing position belong to the left window
+				return start <= position || accept(start, stop, value);
+			});
+		}
+		
+		if (nearest.size() - nearestBegin >= k || outerRadius >= maxDistance)
+		{
+			break;
+		}
+		
+		innerRadius = outerRadius;
+		outerRadius = min<int64_t>(maxDistance, max<int64_t>(1, 2 * outerRadius));
+	}
+	
+	sort(nearest.begin() + nearestBegin, nearest.end(), NearerCmp<T>);
+	if (nearest.size() - nearestBegin > k)
+	{
+		nearest.resize(nearestBegin + k);
+	}
+}
+
+// Visitor of the interval at an index of separate start, stop and value
+// arrays
+template <class T, class TVisitor>
+struct CIndexVisitor
+{
+	CIndexVisitor(const vector<int>& starts, const vector<int>& stops, const vector<T>& values, TVisitor& visitor)
+	: starts(starts), stops(stops), values(values), visitor(visitor)
+	{}
+	
+	bool operator()(size_t index) const
+	{
+		return visitor(starts[index], stops[index], values[index]);
+	}
+	
+	const vector<int>& starts;
+	const vector<int>& stops;
+	const vector<T>& values;
+	TVisitor& visitor;
+};
+
+// Construction state shared by the interval tree engines: an array of
+// indices into the start sorted intervals, and a scratch array of the same
+// size.  Each subtree owns a contiguous range of the index array, which is
+// partitioned in place, so construction allocates no per-level storage.
+template <class T>
+void InitPartition(const vector<CInterval<T> >& intervals, vector<unsigned int>& order, vector<unsigned int>& scratch)
+{
+	order.resize(intervals.size());
+	scratch.resize(intervals.size());
+	for (unsigned int intervalIndex = 0; intervalIndex < intervals.size(); intervalIndex++)
+	{
+		order[intervalIndex] = intervalIndex;
+	}
+}
+
+// Stable partition of order[begin, end) into intervals left of, spanning, and
+// right of center, keeping each part sorted by start.  The spanning intervals
+// end up in order[centersBegin, centersEnd).
+template <class T>
+void PartitionIntervals(const vector<CInterval<T> >& intervals, vector<unsigned int>& order, vector<unsigned int>& scratch,
+						unsigned int begin, unsigned int end, int center, unsigned int& centersBegin, unsigned int& centersEnd)
+{
+	unsigned int numLefts = 0;
+	unsigned int numCenters = 0;
+	for (unsigned int orderIndex = begin; orderIndex != end; orderIndex++)
+	{
+		const CInterval<T>& interval = intervals[order[orderIndex]];
+		if (interval.stop < center)
+		{
+			numLefts++;
+		}
+		else if (interval.start <= center)
+		{
+			numCenters++;
+		}
+	}
+	
+	centersBegin = begin + numLefts;
+	centersEnd = centersBegin + numCenters;
+	
+	unsigned int leftsNext = begin;
+	unsigned int centersNext = centersBegin;
+	unsigned int rightsNext = centersEnd;
+	for (unsigned int orderIndex = begin; orderIndex != end; orderIndex++)
+	{
+		const CInterval<T>& interval = intervals[order[orderIndex]];
+		if (interval.stop < center)
+		{
+			scratch[leftsNext++] = order[orderIndex];
+		}
+		else if (interval.start > center)
+		{
+			scratch[rightsNext++] = order[orderIndex];
+		}
+		else
+		{
+			scratch[centersNext++] = order[orderIndex];
+		}
+	}
+	
+	copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+}
+
 template <class T>
 class CIntervalTree
 {
 public:
-	CIntervalTree<T>() : mLeft(0), mRight(0), mCenter(0) {}
+	CIntervalTree<T>() : mLeft(0), mRight(0), mCenter(0), mCentered(false) {}
 	
 	CIntervalTree<T>(const CIntervalTree<T>& other)
 	{
 		mCenter = other.mCenter;
+		mCentered = other.mCentered;
 		
-		mIntervals = other.mIntervals;
+		mStarts = other.mStarts;
+		mStops = other.mStops;
+		mValues = other.mValues;
+		mStopOrderStarts = other.mStopOrderStarts;
+		mStopOrderStops = other.mStopOrderStops;
+		mStopOrderValues = other.mStopOrderValues;
 		
 		if (other.mLeft)
 		{
@@ -113,8 +377,14 @@ public:
 	CIntervalTree<T>& operator=(const CIntervalTree<T>& other)
 	{
 		mCenter = other.mCenter;
+		mCentered = other.mCentered;
 		
-		mIntervals = other.mIntervals;
+		mStarts = other.mStarts;
+		mStops = other.mStops;
+		mValues = other.mValues;
+		mStopOrderStarts = other.mStopOrderStarts;
+		mStopOrderStops = other.mStopOrderStops;
+		mStopOrderValues = other.mStopOrderValues;
 		
 		delete mLeft;
 		if (other.mLeft)
@@ -139,31 +409,70 @@ public:
 		return *this;
 	}
 	
-	CIntervalTree<T>(vector<CInterval<T> >& intervals, 
+	CIntervalTree<T>(CIntervalTree<T>&& other) noexcept
+	: mStarts(std::move(other.mStarts)), mStops(std::move(other.mStops)), mValues(std::move(other.mValues)),
+	  mStopOrderStarts(std::move(other.mStopOrderStarts)), mStopOrderStops(std::move(other.mStopOrderStops)),
+	  mStopOrderValues(std::move(other.mStopOrderValues)),
+	  mLeft(other.mLeft), mRight(other.mRight), mCenter(other.mCenter), mCentered(other.mCentered)
+	{
+		other.mLeft = 0;
+		other.mRight = 0;
+	}
+	
+	CIntervalTree<T>& operator=(CIntervalTree<T>&& other) noexcept
+	{
+		if (this != &other)
+		{
+			delete mLeft;
+			delete mRight;
+			
+			mCenter = other.mCenter;
+			mCentered = other.mCentered;
+			mStarts = std::move(other.mStarts);
+			mStops = std::move(other.mStops);
+			mValues = std::move(other.mValues);
+			mStopOrderStarts = std::move(other.mStopOrderStarts);
+			mStopOrderStops = std::move(other.mStopOrderStops);
+			mStopOrderValues = std::move(other.mStopOrderValues);
+			mLeft = other.mLeft;
+			mRight = other.mRight;
+			
+			other.mLeft = 0;
+			other.mRight = 0;
+		}
+		
+		return *this;
+	}
+	
+	CIntervalTree<T>(vector<CInterval<T> >& intervals,
 					unsigned int maxdepth = 16,
 					unsigned int minbucket = 64,
 					unsigned int maxbucket = 512)
-	: mLeft(0), mRight(0)
+	: mLeft(0), mRight(0), mCenter(0), mCentered(false)
 	{
+		if (intervals.empty())
+		{
+			return;
+		}
+		
 		sort(intervals.begin(), intervals.end(), StartCmp<T>);
 		
-		int leftextent = intervals.front().start;
-		int rightextent = max_element(intervals.begin(), intervals.end(), StopCmp<T>)->stop;
+		vector<unsigned int> order;
+		vector<unsigned int> scratch;
+		InitPartition(intervals, order, scratch);
 		
-		Construct(intervals, maxdepth, minbucket, maxbucket, leftextent, rightextent);
+		Construct(intervals, order, scratch, 0, order.size(), maxdepth, minbucket, maxbucket);
 	}
 	
 	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
 	{
-		if (stop >= mIntervals.front().start)
+		if (mCentered && start <= stop)
 		{
-			for (typename vector<CInterval<T> >::const_iterator intervalIter = mIntervals.begin(); intervalIter != mIntervals.end(); intervalIter++)
-			{
-				if (intervalIter->stop >= start && intervalIter->start <= stop)
-				{
-					overlapping.push_back(intervalIter->value);
-				}
-			}
+			FindOverlappingCenters(start, stop, overlapping);
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			AppendScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), mValues, 0, mStarts.size(), start, stop, overlapping);
 		}
 		
 		if (mLeft && start <= mCenter)
@@ -179,16 +488,21 @@ public:
 	
 	void FindContained(int start, int stop, vector<T>& contained) const
 	{
-		if (stop >= mIntervals.front().start)
+		if (mCentered && start <= stop)
 		{
-			for (typename vector<CInterval<T> >::const_iterator intervalIter = mIntervals.begin(); intervalIter != mIntervals.end(); intervalIter++)
+			// Center intervals contain the center, so only queries containing
+			// the center contain any, and those starting after the query
+			// start are a suffix in start order
+			if (start <= mCenter && stop >= mCenter)
 			{
-				if (intervalIter->start >= start && intervalIter->stop <= stop)
-				{
-					contained.push_back(intervalIter->value);
-				}
+				size_t begin = lower_bound(mStarts.begin(), mStarts.end(), start) - mStarts.begin();
+				AppendScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), mValues, begin, mStarts.size(), start, stop, contained);
 			}
 		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			AppendScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), mValues, 0, mStarts.size(), start, stop, contained);
+		}
 		
 		if (mLeft && start <= mCenter)
 		{
@@ -205,10 +519,167 @@ public:
 	void FindNearest(int position, vector<T>& nearest) const
 	{
 		NearestAccumulator<T> nearestAccumulator;
-		FindNearest(position, nearestAccumulator);
+		AccumulateNearest(position, nearestAccumulator);
 		nearest.insert(nearest.end(), nearestAccumulator.Get().begin(), nearestAccumulator.Get().end());
 	}
 	
+	// Number of intervals overlapping [start, stop], counted without
+	// collecting their values
+	size_t CountOverlapping(int start, int stop) const
+	{
+		size_t count = 0;
+		
+		if (mCentered && start <= stop)
+		{
+			GetOverlappingCenters(start, stop, count);
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			count = CountScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), 0, mStarts.size(), start, stop);
+		}
+		
+		if (mLeft && start <= mCenter)
+		{
+			count += mLeft->CountOverlapping(start, stop);
+		}
+		
+		if (mRight && stop >= mCenter)
+		{
+			count += mRight->CountOverlapping(start, stop);
+		}
+		
+		return count;
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		size_t count = 0;
+		
+		if (mCentered && start <= stop)
+		{
+			if (start <= mCenter && stop >= mCenter)
+			{
+				size_t begin = lower_bound(mStarts.begin(), mStarts.end(), start) - mStarts.begin();
+				count = CountScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), begin, mStarts.size(), start, stop);
+			}
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			count = CountScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), 0, mStarts.size(), start, stop);
+		}
+		
+		if (mLeft && start <= mCenter)
+		{
+			count += mLeft->CountContained(start, stop);
+		}
+		
+		if (mRight && stop >= mCenter)
+		{
+			count += mRight->CountContained(start, stop);
+		}
+		
+		return count;
+	}
+	
+	// Call visitor(start, stop, value) for each interval overlapping [start,
+	// stop] until it returns false, returning false if it did, so that
+	// results can be aggregated without collecting them
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		if (mCentered && start <= stop)
+		{
+			if (!VisitOverlappingCenters(start, stop, visitor))
+			{
+				return false;
+			}
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			if (!VisitScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), 0, mStarts.size(), start, stop, GetIntervalVisitor(visitor)))
+			{
+				return false;
+			}
+		}
+		
+		return (!mLeft || start > mCenter || mLeft->FindOverlapping(start, stop, visitor)) &&
+			   (!mRight || stop < mCenter || mRight->FindOverlapping(start, stop, visitor));
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		if (mCentered && start <= stop)
+		{
+			if (start <= mCenter && stop >= mCenter)
+			{
+				size_t begin = lower_bound(mStarts.begin(), mStarts.end(), start) - mStarts.begin();
+				if (!VisitScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), begin, mStarts.size(), start, stop, GetIntervalVisitor(visitor)))
+				{
+					return false;
+				}
+			}
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			if (!VisitScanBetween(GetScanKernels(), mStarts.data(), mStops.data(), 0, mStarts.size(), start, stop, GetIntervalVisitor(visitor)))
+			{
+				return false;
+			}
+		}
+		
+		return (!mLeft || start > mCenter || mLeft->FindContained(start, stop, visitor)) &&
+			   (!mRight || stop < mCenter || mRight->FindContained(start, stop, visitor));
+	}
+	
+	// Visit the nearest intervals to position, found by a first pass for the
+	// nearest distance
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		NearestDistanceAccumulator nearestDistance;
+		AccumulateNearest(position, nearestDistance);
+		return VisitNearest<T>(*this, position, nearestDistance.GetDistance(), visitor);
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, CAcceptAllIntervals(), nearest);
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, filter, nearest);
+	}
+	
+	// Whether any interval overlaps [start, stop], stopping at the first
+	bool AnyOverlapping(int start, int stop) const
+	{
+		if (mCentered && start <= stop)
+		{
+			size_t numOverlapping;
+			GetOverlappingCenters(start, stop, numOverlapping);
+			if (numOverlapping != 0)
+			{
+				return true;
+			}
+		}
+		else if (!mStarts.empty() && stop >= mStarts.front())
+		{
+			if (AnyScanBetween(GetScanKernels(), mStops.data(), mStarts.data(), 0, mStarts.size(), start, stop))
+			{
+				return true;
+			}
+		}
+		
+		return (mLeft && start <= mCenter && mLeft->AnyOverlapping(start, stop)) ||
+			   (mRight && stop >= mCenter && mRight->AnyOverlapping(start, stop));
+	}
+	
 	~CIntervalTree()
 	{
 		delete mLeft;
@@ -216,92 +687,243 @@ public:
 	}
 	
 private:
-	CIntervalTree<T>(vector<CInterval<T> >& intervals, 
-					unsigned int maxdepth,
+	CIntervalTree<T>(const vector<CInterval<T> >& intervals,
+					vector<unsigned int>& order,
+					vector<unsigned int>& scratch,
+					unsigned int begin,
+					unsigned int end,
+					unsigned int depth,
 					unsigned int minbucket,
-					unsigned int maxbucket,
-					int leftextent,
-					int rightextent)
-	: mLeft(0), mRight(0)
+					unsigned int maxbucket)
+	: mLeft(0), mRight(0), mCenter(0), mCentered(false)
 	{
-		Construct(intervals, maxdepth, minbucket, maxbucket, leftextent, rightextent);
+		Construct(intervals, order, scratch, begin, end, depth, minbucket, maxbucket);
 	}
 	
-	void Construct(vector<CInterval<T> >& intervals, unsigned int depth, unsigned int minbucket,
-				   unsigned int maxbucket, int leftextent, int rightextent)
+	void Construct(const vector<CInterval<T> >& intervals, vector<unsigned int>& order, vector<unsigned int>& scratch,
+				   unsigned int begin, unsigned int end, unsigned int depth, unsigned int minbucket, unsigned int maxbucket)
 	{
-		if (depth == 1 || (intervals.size() < minbucket && intervals.size() < maxbucket))
+		unsigned int size = end - begin;
+		
+		if (depth == 1 || (size < minbucket && size < maxbucket))
 		{
-			mIntervals = intervals;
+			AddIntervals(intervals, order, begin, end);
 		}
 		else
 		{
-			mCenter = intervals.at(intervals.size() / 2).start;
+			mCenter = intervals[order[begin + size / 2]].start;
 			
-			vector<CInterval<T> > lefts;
-			vector<CInterval<T> > rights;
+			unsigned int centersBegin;
+			unsigned int centersEnd;
+			PartitionIntervals(intervals, order, scratch, begin, end, mCenter, centersBegin, centersEnd);
 			
-			for (typename vector<CInterval<T> >::iterator i = intervals.begin(); i != intervals.end(); ++i)
-			{
-				CInterval<T>& interval = *i;
-				if (interval.stop < mCenter)
-				{
-					lefts.push_back(interval);
-				}
-				else if (interval.start > mCenter)
-				{
-					rights.push_back(interval);
-				}
-				else
-				{
-					mIntervals.push_back(interval);
-				}
-			}
+			AddIntervals(intervals, order, centersBegin, centersEnd);
+			AddStopOrder();
+			mCentered = true;
 			
-			if (!lefts.empty())
+			if (centersBegin != begin)
 			{
-				mLeft = new CIntervalTree<T>(lefts, depth - 1, minbucket, maxbucket, leftextent, mCenter);
+				mLeft = new CIntervalTree<T>(intervals, order, scratch, begin, centersBegin, depth - 1, minbucket, maxbucket);
 			}
-			if (!rights.empty())
+			if (centersEnd != end)
 			{
-				mRight = new CIntervalTree<T>(rights, depth - 1, minbucket, maxbucket, mCenter, rightextent);
+				mRight = new CIntervalTree<T>(intervals, order, scratch, centersEnd, end, depth - 1, minbucket, maxbucket);
 			}
 		}
 	}
 	
-	void FindNearest(int position, NearestAccumulator<T>& nearest) const
+	void AddIntervals(const vector<CInterval<T> >& intervals, const vector<unsigned int>& order, unsigned int begin, unsigned int end)
 	{
-		for (typename vector<CInterval<T> >::const_iterator intervalIter = mIntervals.begin(); intervalIter != mIntervals.end(); intervalIter++)
+		mStarts.reserve(end - begin);
+		mStops.reserve(end - begin);
+		mValues.reserve(end - begin);
+		for (unsigned int orderIndex = begin; orderIndex != end; orderIndex++)
 		{
-			if (position < intervalIter->start)
-			{
-				nearest.Add(intervalIter->start - position, intervalIter->value);
-			}
-			else if (position > intervalIter->stop)
+			const CInterval<T>& interval = intervals[order[orderIndex]];
+			mStarts.push_back(interval.start);
+			mStops.push_back(interval.stop);
+			mValues.push_back(interval.value);
+		}
+	}
+	
+	// Center intervals in descending stop order
+	void AddStopOrder()
+	{
+		vector<unsigned int> stopOrder(mStops.size());
+		for (unsigned int intervalIndex = 0; intervalIndex < stopOrder.size(); intervalIndex++)
+		{
+			stopOrder[intervalIndex] = intervalIndex;
+		}
+		stable_sort(stopOrder.begin(), stopOrder.end(), CStopGreater(mStops));
+		
+		mStopOrderStarts.reserve(stopOrder.size());
+		mStopOrderStops.reserve(stopOrder.size());
+		mStopOrderValues.reserve(stopOrder.size());
+		for (vector<unsigned int>::const_iterator stopOrderIter = stopOrder.begin(); stopOrderIter != stopOrder.end(); stopOrderIter++)
+		{
+			mStopOrderStarts.push_back(mStarts[*stopOrderIter]);
+			mStopOrderStops.push_back(mStops[*stopOrderIter]);
+			mStopOrderValues.push_back(mValues[*stopOrderIter]);
+		}
+	}
+	
+	struct CStopGreater
+	{
+		CStopGreater(const vector<int>& stops) : stops(stops) {}
+		
+		bool operator()(unsigned int intervalIndex1, unsigned int intervalIndex2) const
+		{
+			return stops[intervalIndex1] > stops[intervalIndex2];
+		}
+		
+		const vector<int>& stops;
+	};
+	
+	// Center intervals all contain the center, so those overlapping a query
+	// left of the center are a prefix in start order, those overlapping a
+	// query right of the center are a prefix in descending stop order, and
+	// all overlap a query containing the center.  Returns the values in the
+	// order of which the first numOverlapping overlap the query.
+	const vector<T>& GetOverlappingCenters(int start, int stop, size_t& numOverlapping) const
+	{
+		if (stop < mCenter)
+		{
+			numOverlapping = upper_bound(mStarts.begin(), mStarts.end(), stop) - mStarts.begin();
+			return mValues;
+		}
+		else if (start > mCenter)
+		{
+			numOverlapping = upper_bound(mStopOrderStops.begin(), mStopOrderStops.end(), start, greater<int>()) - mStopOrderStops.begin();
+			return mStopOrderValues;
+		}
+		else
+		{
+			numOverlapping = mValues.size();
+			return mValues;
+		}
+	}
+	
+	void FindOverlappingCenters(int start, int stop, vector<T>& overlapping) const
+	{
+		size_t numOverlapping;
+		const vector<T>& values = GetOverlappingCenters(start, stop, numOverlapping);
+		overlapping.insert(overlapping.end(), values.begin(), values.begin() + numOverlapping);
+	}
+	
+	template <class TVisitor>
+	bool VisitOverlappingCenters(int start, int stop, TVisitor& visitor) const
+	{
+		if (start > mCenter)
+		{
+			size_t numOverlapping = upper_bound(mStopOrderStops.begin(), mStopOrderStops.end(), start, greater<int>()) - mStopOrderStops.begin();
+			return VisitIntervals(mStopOrderStarts, mStopOrderStops, mStopOrderValues, numOverlapping, visitor);
+		}
+		
+		size_t numOverlapping = (stop < mCenter) ? upper_bound(mStarts.begin(), mStarts.end(), stop) - mStarts.begin() : mStarts.size();
+		return VisitIntervals(mStarts, mStops, mValues, numOverlapping, visitor);
+	}
+	
+	template <class TVisitor>
+	static bool VisitIntervals(const vector<int>& starts, const vector<int>& stops, const vector<T>& values, size_t numIntervals, TVisitor& visitor)
+	{
+		for (size_t intervalIndex = 0; intervalIndex < numIntervals; intervalIndex++)
+		{
+			if (!visitor(starts[intervalIndex], stops[intervalIndex], values[intervalIndex]))
 			{
-				nearest.Add(position - intervalIter->stop, intervalIter->value);
+				return false;
 			}
-			else
+		}
+		return true;
+	}
+	
+	// Adapt a visitor of intervals to a visitor of indices of the start
+	// order arrays, as called by the scan kernels
+	template <class TVisitor>
+	CIndexVisitor<T, TVisitor> GetIntervalVisitor(TVisitor& visitor) const
+	{
+		return CIndexVisitor<T, TVisitor>(mStarts, mStops, mValues, visitor);
+	}
+	
+	// The nearest center intervals to a position left of the center are
+	// those containing it, a prefix in start order, or failing that those
+	// with the first start, and similarly in descending stop order for a
+	// position right of the center
+	template <class TNearest>
+	void FindNearestCenters(int position, TNearest& nearest) const
+	{
+		if (mStarts.empty())
+		{
+			return;
+		}
+		
+		if (position < mCenter)
+		{
+			int distance = max(0, mStarts.front() - position);
+			size_t numNearest = upper_bound(mStarts.begin(), mStarts.end(), max(position, mStarts.front())) - mStarts.begin();
+			AddNearest(distance, mValues, numNearest, nearest);
+		}
+		else if (position > mCenter)
+		{
+			int distance = max(0, position - mStopOrderStops.front());
+			size_t numNearest = upper_bound(mStopOrderStops.begin(), mStopOrderStops.end(), min(position, mStopOrderStops.front()), greater<int>()) - mStopOrderStops.begin();
+			AddNearest(distance, mStopOrderValues, numNearest, nearest);
+		}
+		else
+		{
+			AddNearest(0, mValues, mValues.size(), nearest);
+		}
+	}
+	
+	template <class TNearest>
+	static void AddNearest(int distance, const vector<T>& values, size_t numValues, TNearest& nearest)
+	{
+		if (distance <= nearest.GetDistance())
+		{
+			for (size_t valueIndex = 0; valueIndex < numValues; valueIndex++)
 			{
-				nearest.Add(0, intervalIter->value);
+				nearest.Add(distance, values[valueIndex]);
 			}
 		}
+	}
+	
+	template <class TNearest>
+	void AccumulateNearest(int position, TNearest& nearest) const
+	{
+		if (mCentered)
+		{
+			FindNearestCenters(position, nearest);
+		}
+		else
+		{
+			AddScanNearest(GetScanKernels(), mStarts.data(), mStops.data(), mValues, mStarts.size(), position, nearest);
+		}
 		
 		if (mLeft && position < mCenter)
 		{
-			mLeft->FindNearest(position, nearest);
+			mLeft->AccumulateNearest(position, nearest);
 		}
 		
 		if (mRight && position > mCenter)
 		{
-			mRight->FindNearest(position, nearest);
+			mRight->AccumulateNearest(position, nearest);
 		}
 	}
 	
-	vector<CInterval<T> > mIntervals;
+	// Intervals spanning the center, or all intervals of a leaf, in start
+	// order and stored as separate arrays for vectorized scans
+	vector<int> mStarts;
+	vector<int> mStops;
+	vector<T> mValues;
+	
+	// Intervals spanning the center in descending stop order
+	vector<int> mStopOrderStarts;
+	vector<int> mStopOrderStops;
+	vector<T> mStopOrderValues;
+	
 	CIntervalTree<T>* mLeft;
 	CIntervalTree<T>* mRight;
 	int mCenter;
+	bool mCentered;
 };
 
 #endif
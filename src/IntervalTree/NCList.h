@@ -0,0 +1,346 @@
+#ifndef __NCLIST_H
+#define __NCLIST_H
+
+#include "IntervalTree.h"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+
+// Nested containment list with the same query semantics as CIntervalTree.
+// Intervals are arranged in lists in which none contains another, so that
+// both starts and stops increase along each list.  Each interval contained
+// in another is placed in the sublist of the smallest interval containing
+// it.  Lists are stored contiguously in breadth first order, the top level
+// list first, and intervals as separate start, stop and value arrays.
+template <class T>
+class CNCList
+{
+public:
+	CNCList<T>() {}
+	
+	CNCList<T>(vector<CInterval<T> >& intervals)
+	{
+		if (intervals.empty())
+		{
+			return;
+		}
+		
+		sort(intervals.begin(), intervals.end(), NestedCmp);
+		
+		// Parent of each interval is the nearest preceding interval in
+		// nested order that contains it, those without parents are top level
+		vector<int> parents(intervals.size());
+		vector<int> containing;
+		for (int intervalIndex = 0; intervalIndex < (int)intervals.size(); intervalIndex++)
+		{
+			while (!containing.empty() && intervals[containing.back()].stop < intervals[intervalIndex].stop)
+			{
+				containing.pop_back();
+			}
+			parents[intervalIndex] = containing.empty() ? -1 : containing.back();
+			containing.push_back(intervalIndex);
+		}
+		
+		// Children of each interval in nested order, indexed by parent + 1
+		// with the top level list first
+		vector<unsigned int> childOffsets(intervals.size() + 2, 0);
+		for (vector<int>::const_iterator parentIter = parents.begin(); parentIter != parents.end(); parentIter++)
+		{
+			childOffsets[*parentIter + 2]++;
+		}
+		for (size_t offsetIndex = 1; offsetIndex < childOffsets.size(); offsetIndex++)
+		{
+			childOffsets[offsetIndex] += childOffsets[offsetIndex - 1];
+		}
+		vector<unsigned int> children(intervals.size());
+		for (int intervalIndex = 0; intervalIndex < (int)intervals.size(); intervalIndex++)
+		{
+			children[childOffsets[parents[intervalIndex] + 1]++] = intervalIndex;
+		}
+		
+		// After filling, childOffsets[key] is the end of the children of key,
+		// and the beginning of the children of key + 1
+		mStarts.reserve(intervals.size());
+		mStops.reserve(intervals.size());
+		mValues.reserve(intervals.size());
+		mSublists.reserve(intervals.size());
+		
+		vector<int> listKeys(1, 0);
+		mListOffsets.push_back(0);
+		mListParents.push_back(-1);
+		mListParentLists.push_back(-1);
+		for (size_t listIndex = 0; listIndex < listKeys.size(); listIndex++)
+		{
+			int key = listKeys[listIndex];
+			unsigned int childrenBegin = (key == 0) ? 0 : childOffsets[key - 1];
+			unsigned int childrenEnd = childOffsets[key];
+			for (unsigned int childIndex = childrenBegin; childIndex != childrenEnd; childIndex++)
+			{
+				const CInterval<T>& interval = intervals[children[childIndex]];
+				mStarts.push_back(interval.start);
+				mStops.push_back(interval.stop);
+				mValues.push_back(interval.value);
+				
+				int childKey = children[childIndex] + 1;
+				if (childOffsets[childKey] != childOffsets[childKey - 1])
+				{
+					mSublists.push_back(listKeys.size());
+					mListParents.push_back(mStarts.size() - 1);
+					mListParentLists.push_back(listIndex);
+					listKeys.push_back(childKey);
+				}
+				else
+				{
+					mSublists.push_back(-1);
+				}
+			}
+			mListOffsets.push_back(mStarts.size());
+		}
+	}
+	
+	void FindOverlapping(int start, int stop, vector<T>& overlapping) const
+	{
+		VisitOverlapping(start, stop, [&](unsigned int index)
+		{
+			overlapping.push_back(mValues[index]);
+			return true;
+		});
+	}
+	
+	void FindContained(int start, int stop, vector<T>& contained) const
+	{
+		VisitOverlapping(start, stop, [&](unsigned int index)
+		{
+			if (mStarts[index] >= start && mStops[index] <= stop)
+			{
+				contained.push_back(mValues[index]);
+			}
+			return true;
+		});
+	}
+	
+	void FindNearest(int position, vector<T>& nearest) const
+	{
+		if (mStarts.empty())
+		{
+			return;
+		}
+		
+		size_t nearestBegin = nearest.size();
+		FindOverlapping(position, position, nearest);
+		if (nearest.size() != nearestBegin)
+		{
+			return;
+		}
+		
+		// No interval contains position, so all intervals nested in top
+		// level intervals before position end before it, and all nested
+		// in those after start after it.  The nearest are the last top
+		// level interval before position and the first after, with any
+		// nested intervals sharing their stop or start respectively.
+		unsigned int topEnd = mListOffsets[1];
+		unsigned int after = upper_bound(mStarts.begin(), mStarts.begin() + topEnd, position) - mStarts.begin();
+		
+		int beforeDistance = (after > 0) ? position - mStops[after - 1] : numeric_limits<int>::max();
+		int afterDistance = (after < topEnd) ? mStarts[after] - position : numeric_limits<int>::max();
+		
+		if (after > 0 && beforeDistance <= afterDistance)
+		{
+			// Nested intervals ending with their parent are last in its sublist
+			for (int index = after - 1; index >= 0 && mStops[index] == mStops[after - 1]; )
+			{
+				nearest.push_back(mValues[index]);
+				index = (mSublists[index] >= 0) ? (int)mListOffsets[mSublists[index] + 1] - 1 : -1;
+			}
+		}
+		
+		if (after < topEnd && afterDistance <= beforeDistance)
+		{
+			// Nested intervals starting with their parent are first in its sublist
+			for (int index = after; index >= 0 && mStarts[index] == mStarts[after]; )
+			{
+				nearest.push_back(mValues[index]);
+				index = (mSublists[index] >= 0) ? (int)mListOffsets[mSublists[index]] : -1;
+			}
+		}
+	}
+	
+	// Call visitor(start, stop, value) for each interval overlapping [start,
+	// stop] until it returns false, returning false if it did
+	template <class TVisitor>
+	bool FindOverlapping(int start, int stop, TVisitor&& visitor) const
+	{
+		return VisitOverlapping(start, stop, [&](unsigned int index)
+		{
+			return visitor(mStarts[index], mStops[index], mValues[index]);
+		});
+	}
+	
+	template <class TVisitor>
+	bool FindContained(int start, int stop, TVisitor&& visitor) const
+	{
+		return VisitOverlapping(start, stop, [&](unsigned int index)
+		{
+			return mStarts[index] < start || mStops[index] > stop || visitor(mStarts[index], mStops[index], mValues[index]);
+		});
+	}
+	
+	template <class TVisitor>
+	bool FindNearest(int position, TVisitor&& visitor) const
+	{
+		return VisitNearest<T>(*this, position, FindNearestDistance(position), visitor);
+	}
+	
+	// Up to k (value, signed distance) pairs of the intervals nearest to
+	// position and at most maxDistance from it, in order of distance, as for
+	// FindKNearestIntervals
+	void FindKNearest(int position, size_t k, int maxDistance, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, CAcceptAllIntervals(), nearest);
+	}
+	
+	template <class TFilter>
+	void FindKNearest(int position, size_t k, int maxDistance, TFilter filter, vector<pair<T, int> >& nearest) const
+	{
+		FindKNearestIntervals<T>(*this, position, k, maxDistance, filter, nearest);
+	}
+	
+	size_t CountOverlapping(int start, int stop) const
+	{
+		size_t count = 0;
+		VisitOverlapping(start, stop, [&](unsigned int)
+		{
+			count++;
+			return true;
+		});
+		return count;
+	}
+	
+	size_t CountContained(int start, int stop) const
+	{
+		size_t count = 0;
+		VisitOverlapping(start, stop, [&](unsigned int index)
+		{
+			count += (mStarts[index] >= start && mStops[index] <= stop);
+			return true;
+		});
+		return count;
+	}
+	
+	// An interval overlapping the query is nested in a top level interval
+	// that also overlaps it, and of the top level intervals ending at or
+	// after the query start the first starts first
+	bool AnyOverlapping(int start, int stop) const
+	{
+		if (mStarts.empty())
+		{
+			return false;
+		}
+		
+		unsigned int index = FindFirstOverlapping(0, start);
+		return index != mListOffsets[1] && mStarts[index] <= stop;
+	}
+	
+private:
+	// Start order, with intervals containing others before them
+	static bool NestedCmp(const CInterval<T>& a, const CInterval<T>& b)
+	{
+		return a.start < b.start || (a.start == b.start && a.stop > b.stop);
+	}
+	
+	// Call visit(index) for each interval overlapping [start, stop] until it
+	// returns false.  Each list is scanned from its first interval ending at
+	// or after start until intervals start after stop, descending into
+	// sublists as they are reached, and continuing after the parent of each
+	// finished sublist, so no stack is needed however deep the nesting.
+	template <class TVisit>
+	bool VisitOverlapping(int start, int stop, TVisit visit) const
+	{
+		if (mStarts.empty())
+		{
+			return true;
+		}
+		
+		int listIndex = 0;
+		unsigned int index = FindFirstOverlapping(0, start);
+		while (true)
+		{
+			if (index != mListOffsets[listIndex + 1] && mStarts[index] <= stop)
+			{
+				if (!visit(index))
+				{
+					return false;
+				}
+				
+				if (mSublists[index] >= 0)
+				{
+					listIndex = mSublists[index];
+					index = FindFirstOverlapping(listIndex, start);
+				}
+				else
+				{
+					index++;
+				}
+			}
+			else if (listIndex == 0)
+			{
+				return true;
+			}
+			else
+			{
+				index = mListParents[listIndex] + 1;
+				listIndex = mListParentLists[listIndex];
+			}
+		}
+	}
+	
+	// Distance of the nearest intervals to position, from the top level
+	// intervals as for FindNearest, or the maximum int if there are none
+	int FindNearestDistance(int position) const
+	{
+		if (mStarts.empty())
+		{
+			return numeric_limits<int>::max();
+		}
+		
+		if (AnyOverlapping(position, position))
+		{
+			return 0;
+		}
+		
+		unsigned int topEnd = mListOffsets[1];
+		unsigned int after = upper_bound(mStarts.begin(), mStarts.begin() + topEnd, position) - mStarts.begin();
+		
+		int beforeDistance = (after > 0) ? position - mStops[after - 1] : numeric_limits<int>::max();
+		int afterDistance = (after < topEnd) ? mStarts[after] - position : numeric_limits<int>::max();
+		return min(beforeDistance, afterDistance);
+	}
+	
+	// First interval of a list ending at or after start, stops increasing
+	// along each list
+	unsigned int FindFirstOverlapping(int listIndex, int start) const
+	{
+		return lower_bound(mStops.begin() + mListOffsets[listIndex], mStops.begin() + mListOffsets[listIndex + 1], start) - mStops.begin();
+	}
+	
+	vector<int> mStarts;
+	vector<int> mStops;
+	vector<T> mValues;
+	
+	// Sublist of each interval, or -1
+	vector<int> mSublists;
+	
+	// Intervals of list i are [mListOffsets[i], mListOffsets[i + 1])
+	vector<unsigned int> mListOffsets;
+	
+	// Interval of which list i is the sublist, and the list of that
+	// interval, -1 for the top level list
+	vector<int> mListParents;
+	vector<int> mListParentLists;
+};
+
+#endif
@@ -5,6 +5,10 @@
 #include <time.h>
 #include <assert.h>
 #include "IntervalTree.h"
+#include "FlatIntervalTree.h"
+#include "NCList.h"
+#include "AIList.h"
+#include "IntervalIndex.h"
 
 using namespace std;
 
@@ -20,6 +24,115 @@ CInterval<T> randomInterval(int maxStart, int maxLength, int maxStop, const T& v
     return CInterval<T>(start, stop, value);
 }
 
+struct EvenAfter {
+    bool operator()(int start, int stop, int value, int distance) const {
+        return value % 2 == 0 && distance > 0;
+    }
+};
+
+// check k nearest queries of an index against all (value, signed distance)
+// pairs in nearest order
+template<class TIndex, class TFilter>
+void checkKNearest(const TIndex& index, int position, size_t k, int maxdistance, TFilter filter, const vector<pair<int, int> >& all) {
+    vector<pair<int, int> > expected;
+    for (vector<pair<int, int> >::const_iterator n = all.begin(); n != all.end() && expected.size() < k; ++n) {
+        if (abs(n->second) <= maxdistance && filter(0, 0, n->first, n->second)) {
+            expected.push_back(*n);
+        }
+    }
+    vector<pair<int, int> > knearest;
+    index.FindKNearest(position, k, maxdistance, filter, knearest);
+    assert(knearest == expected);
+}
+
+// check overlapping, contained, nearest and k nearest queries, and counts,
+// of an interval index against brute force
+template<class TIndex>
+void checkQueries(const TIndex& index, const vector<CInterval<int> >& intervals, const vector<CInterval<bool> >& queries) {
+    for (vector<CInterval<bool> >::const_iterator q = queries.begin(); q != queries.end(); ++q) {
+        vector<int> expectedoverlapping;
+        vector<int> expectedcontained;
+        vector<int> expectednearest;
+        int nearestdistance = numeric_limits<int>::max();
+        for (vector<CInterval<int> >::const_iterator i = intervals.begin(); i != intervals.end(); ++i) {
+            if (i->stop >= q->start && i->start <= q->stop) {
+                expectedoverlapping.push_back(i->value);
+            }
+            if (i->start >= q->start && i->stop <= q->stop) {
+                expectedcontained.push_back(i->value);
+            }
+            int distance = max(0, max(i->start - q->start, q->start - i->stop));
+            if (distance < nearestdistance) {
+                nearestdistance = distance;
+                expectednearest.clear();
+            }
+            if (distance == nearestdistance) {
+                expectednearest.push_back(i->value);
+            }
+        }
+        vector<int> overlapping;
+        vector<int> contained;
+        vector<int> nearest;
+        index.FindOverlapping(q->start, q->stop, overlapping);
+        index.FindContained(q->start, q->stop, contained);
+        index.FindNearest(q->start, nearest);
+        sort(overlapping.begin(), overlapping.end());
+        sort(contained.begin(), contained.end());
+        sort(nearest.begin(), nearest.end());
+        assert(overlapping == expectedoverlapping);
+        assert(contained == expectedcontained);
+        assert(nearest == expectednearest);
+        assert(index.CountOverlapping(q->start, q->stop) == expectedoverlapping.size());
+        assert(index.CountContained(q->start, q->stop) == expectedcontained.size());
+        assert(index.AnyOverlapping(q->start, q->stop) == !expectedoverlapping.empty());
+
+        // visitors see the same results, and stop when they return false
+        vector<int> visited;
+        bool completed = index.FindOverlapping(q->start, q->stop, [&](int start, int stop, int value) {
+            assert(stop >= q->start && start <= q->stop);
+            visited.push_back(value);
+            return true;
+        });
+        sort(visited.begin(), visited.end());
+        assert(completed && visited == expectedoverlapping);
+        visited.clear();
+        completed = index.FindContained(q->start, q->stop, [&](int start, int stop, int value) {
+            visited.push_back(value);
+            return true;
+        });
+        sort(visited.begin(), visited.end());
+        assert(completed && visited == expectedcontained);
+        visited.clear();
+        completed = index.FindNearest(q->start, [&](int start, int stop, int value) {
+            assert(max(0, max(start - q->start, q->start - stop)) == nearestdistance);
+            visited.push_back(value);
+            return true;
+        });
+        sort(visited.begin(), visited.end());
+        assert(completed && visited == expectednearest);
+
+        // k nearest, bounded, and filtered to even values after position,
+        // for a sample of the queries as the brute force sorts
+        if ((q - queries.begin()) % 10 == 0) {
+            vector<pair<int, int> > expectedknearest;
+            for (vector<CInterval<int> >::const_iterator i = intervals.begin(); i != intervals.end(); ++i) {
+                expectedknearest.push_back(make_pair(i->value, SignedDistance(i->start, i->stop, q->start)));
+            }
+            sort(expectedknearest.begin(), expectedknearest.end(), NearerCmp<int>);
+            checkKNearest(index, q->start, 5, numeric_limits<int>::max(), CAcceptAllIntervals(), expectedknearest);
+            checkKNearest(index, q->start, 20, 50, CAcceptAllIntervals(), expectedknearest);
+            checkKNearest(index, q->start, 3, 1000, EvenAfter(), expectedknearest);
+        }
+
+        size_t numvisited = 0;
+        completed = index.FindOverlapping(q->start, q->stop, [&](int start, int stop, int value) {
+            numvisited++;
+            return false;
+        });
+        assert(completed == expectedoverlapping.empty() && numvisited == min((size_t)1, expectedoverlapping.size()));
+    }
+}
+
 int main() {
 
     srand((unsigned)time(NULL));
@@ -62,19 +175,159 @@ int main() {
     vector<int> treecounts;
     t0 = Clock::now();
     for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.end(); ++q) {
-        vector<CInterval<bool> > results;
-        tree.findContained(q->start, q->stop, results);
+        vector<bool> results;
+        tree.FindContained(q->start, q->stop, results);
         treecounts.push_back(results.size());
     }
     t1 = Clock::now();
     ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
     cout << "interval tree:\t" << ms.count() << "ms" << endl;
 
+    // check that moving the tree preserves its contents
+    CIntervalTree<bool> movedtree(std::move(tree));
+    vector<int>::iterator c = treecounts.begin();
+    for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.end(); ++q, ++c) {
+        vector<bool> results;
+        movedtree.FindContained(q->start, q->stop, results);
+        assert(*c == (int)results.size());
+    }
+
+    // using the flat interval tree
+    CFlatIntervalTree<bool> flattree(intervals);
+    vector<int> flattreecounts;
+    t0 = Clock::now();
+    for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.end(); ++q) {
+        vector<bool> results;
+        flattree.FindContained(q->start, q->stop, results);
+        flattreecounts.push_back(results.size());
+    }
+    t1 = Clock::now();
+    ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
+    cout << "flat interval tree:\t" << ms.count() << "ms" << endl;
+
+    // using the nested containment list
+    CNCList<bool> nclist(intervals);
+    vector<int> nclistcounts;
+    t0 = Clock::now();
+    for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.end(); ++q) {
+        vector<bool> results;
+        nclist.FindContained(q->start, q->stop, results);
+        nclistcounts.push_back(results.size());
+    }
+    t1 = Clock::now();
+    ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
+    cout << "nested containment list:\t" << ms.count() << "ms" << endl;
+
+    // using the augmented interval list
+    CAIList<bool> ailist(intervals);
+    vector<int> ailistcounts;
+    t0 = Clock::now();
+    for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.end(); ++q) {
+        vector<bool> results;
+        ailist.FindContained(q->start, q->stop, results);
+        ailistcounts.push_back(results.size());
+    }
+    t1 = Clock::now();
+    ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
+    cout << "augmented interval list:\t" << ms.count() << "ms" << endl;
+
     // check that the same number of results are returned
     vector<int>::iterator b = bruteforcecounts.begin();
     for (vector<int>::iterator t = treecounts.begin(); t != treecounts.end(); ++t, ++b) {
         assert(*b == *t);
     }
+    b = bruteforcecounts.begin();
+    for (vector<int>::iterator t = flattreecounts.begin(); t != flattreecounts.end(); ++t, ++b) {
+        assert(*b == *t);
+    }
+    b = bruteforcecounts.begin();
+    for (vector<int>::iterator t = nclistcounts.begin(); t != nclistcounts.end(); ++t, ++b) {
+        assert(*b == *t);
+    }
+    b = bruteforcecounts.begin();
+    for (vector<int>::iterator t = ailistcounts.begin(); t != ailistcounts.end(); ++t, ++b) {
+        assert(*b == *t);
+    }
+
+    // check overlapping and nearest queries against brute force, including
+    // long intervals spanning the centers of many nodes
+    vector<CInterval<int> > longintervals;
+    for (int i = 0; i < 10000; ++i) {
+        longintervals.push_back(randomInterval(100000, (i % 10 == 0) ? 50000 : 1000, 100000 + 1, i));
+    }
+    vector<CInterval<int> > sortedlongintervals = longintervals;
+    CIntervalTree<int> longtree(sortedlongintervals);
+    CNCList<int> longnclist(sortedlongintervals);
+    CAIList<int> longailist(sortedlongintervals);
+    vector<CInterval<bool> > longqueries(queries.begin(), queries.begin() + 1000);
+    checkQueries(longtree, longintervals, longqueries);
+    checkQueries(longnclist, longintervals, longqueries);
+    checkQueries(longailist, longintervals, longqueries);
+    for (int engine = IntervalTreeEngine; engine <= AIListEngine; ++engine) {
+        checkQueries(CIntervalIndex<int>(sortedlongintervals, (EIntervalEngine)engine), longintervals, longqueries);
+    }
+
+    // nearest visits far from the intervals, where the window around the
+    // position at the nearest distance exceeds int
+    vector<CInterval<int> > extremeintervals;
+    extremeintervals.push_back(CInterval<int>(-10, -5, 1));
+    extremeintervals.push_back(CInterval<int>(5, 10, 2));
+    for (int engine = IntervalTreeEngine; engine <= AIListEngine; ++engine) {
+        vector<CInterval<int> > sortedextremeintervals = extremeintervals;
+        CIntervalIndex<int> extremeindex(sortedextremeintervals, (EIntervalEngine)engine);
+        int positions[] = {numeric_limits<int>::max() - 100, numeric_limits<int>::min() + 100};
+        int expected[] = {2, 1};
+        for (int p = 0; p < 2; ++p) {
+            vector<int> visited;
+            extremeindex.FindNearest(positions[p], [&](int start, int stop, int value) {
+                visited.push_back(value);
+                return true;
+            });
+            assert(visited.size() == 1 && visited[0] == expected[p]);
+        }
+    }
+
+    // and dense intervals, for which queries scan many intervals at once
+    vector<CInterval<int> > denseintervals;
+    for (int i = 0; i < 10000; ++i) {
+        denseintervals.push_back(randomInterval(10000, 1000, 10000 + 1, i));
+    }
+    vector<CInterval<bool> > densequeries;
+    for (int i = 0; i < 1000; ++i) {
+        densequeries.push_back(randomInterval(10000, 2000, 10000 + 1, true));
+    }
+    vector<CInterval<int> > sorteddenseintervals = denseintervals;
+    checkQueries(CIntervalTree<int>(sorteddenseintervals), denseintervals, densequeries);
+    checkQueries(CNCList<int>(sorteddenseintervals), denseintervals, densequeries);
+    checkQueries(CAIList<int>(sorteddenseintervals), denseintervals, densequeries);
+
+    // check that each supported scan kernel matches the scalar kernel,
+    // including partial blocks
+    CScanKernels scalar = GetScanKernels(ScalarScan);
+    for (int level = ScalarScan; level <= GetSupportedScanLevel(); ++level) {
+        CScanKernels kernels = GetScanKernels((EScanLevel)level);
+        for (size_t size = 0; size <= ScanBlockSize; size += 1 + size / 4) {
+            vector<int> starts, stops;
+            for (size_t i = 0; i < size; ++i) {
+                CInterval<bool> interval = randomInterval(100000, 1000, 100000 + 1, true);
+                starts.push_back(interval.start);
+                stops.push_back(interval.stop);
+            }
+            for (vector<CInterval<bool> >::iterator q = queries.begin(); q != queries.begin() + 100; ++q) {
+                uint64_t masks[ScanBlockSize / 64], expectedmasks[ScanBlockSize / 64];
+                kernels.between(stops.data(), starts.data(), size, q->start, q->stop, masks);
+                scalar.between(stops.data(), starts.data(), size, q->start, q->stop, expectedmasks);
+                assert(equal(masks, masks + (size + 63) / 64, expectedmasks));
+
+                int distances[ScanBlockSize], expecteddistances[ScanBlockSize];
+                int mindistance = kernels.distances(starts.data(), stops.data(), size, q->start, distances);
+                int expectedmindistance = scalar.distances(starts.data(), stops.data(), size, q->start, expecteddistances);
+                assert(mindistance == expectedmindistance);
+                assert(equal(distances, distances + size, expecteddistances));
+            }
+        }
+        cout << "scan kernel " << kernels.name << " ok" << endl;
+    }
 
     return 0;
 }
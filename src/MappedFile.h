@@ -0,0 +1,106 @@
+#ifndef __MAPPED_FILE_H
+#define __MAPPED_FILE_H
+
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+// Read only memory mapping of an entire file
+class CMappedFile
+{
+public:
+	CMappedFile() : mData(0), mSize(0) {}
+	
+	~CMappedFile()
+	{
+		Close();
+	}
+	
+	void Open(const string& filename)
+	{
+		Close();
+		
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			stringstream errorStr;
+			errorStr << "File " << filename << " not found";
+			throw std::invalid_argument(errorStr.str());
+		}
+		
+		struct stat fileStat;
+		if (fstat(fd, &fileStat) < 0)
+		{
+			close(fd);
+			stringstream errorStr;
+			errorStr << "Unable to stat file " << filename;
+			throw std::runtime_error(errorStr.str());
+		}
+		
+		mSize = fileStat.st_size;
+		
+		// Empty files cannot be mapped, and are represented by a null mapping
+		if (mSize > 0)
+		{
+			void* data = mmap(0, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data == MAP_FAILED)
+			{
+				close(fd);
+				mSize = 0;
+				stringstream errorStr;
+				errorStr << "Unable to map file " << filename;
+				throw std::runtime_error(errorStr.str());
+			}
+			mData = static_cast<const char*>(data);
+		}
+		
+		close(fd);
+	}
+	
+	void Close()
+	{
+		if (mData)
+		{
+			munmap(const_cast<char*>(mData), mSize);
+		}
+		
+		mData = 0;
+		mSize = 0;
+	}
+	
+	// Hint the expected access pattern, eg MADV_SEQUENTIAL for a single scan
+	void Advise(int advice) const
+	{
+		if (mData)
+		{
+			madvise(const_cast<char*>(mData), mSize, advice);
+		}
+	}
+	
+	const char* GetData() const
+	{
+		return mData;
+	}
+	
+	size_t GetSize() const
+	{
+		return mSize;
+	}
+	
+private:
+	CMappedFile(const CMappedFile&);
+	CMappedFile& operator=(const CMappedFile&);
+	
+	const char* mData;
+	size_t mSize;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef __PARALLEL_FOR_H
+#define __PARALLEL_FOR_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <exception>
+#include <functional>
+#include <unistd.h>
+
+using namespace std;
+
+
+// Range of chunks remaining to a worker, from which the worker takes chunks
+// at the front and other workers steal from the back
+struct CWorkRange
+{
+	CWorkRange() : next(0), end(0) {}
+	
+	mutex lock;
+	size_t next;
+	size_t end;
+};
+
+
+// Shared state of a single ParallelFor
+struct CParallelForState
+{
+	CParallelForState(size_t numItems, size_t chunkSize, size_t numChunks, int numWorkers, const function<void(size_t,size_t)>& body)
+	: numItems(numItems), chunkSize(chunkSize), body(body), ranges(numWorkers),
+	  errorChunk(numeric_limits<size_t>::max())
+	{
+		for (int workerIndex = 0; workerIndex < numWorkers; workerIndex++)
+		{
+			ranges[workerIndex].next = numChunks * workerIndex / numWorkers;
+			ranges[workerIndex].end = numChunks * (workerIndex + 1) / numWorkers;
+		}
+	}
+	
+	size_t numItems;
+	size_t chunkSize;
+	const function<void(size_t,size_t)>& body;
+	vector<CWorkRange> ranges;
+	
+	// Lowest chunk that threw, chunks after it are skipped
+	mutex errorLock;
+	atomic<size_t> errorChunk;
+	exception_ptr error;
+};
+
+
+// Take the next chunk of a worker's own range
+inline bool TakeChunk(CWorkRange& range, size_t& chunkIndex)
+{
+	lock_guard<mutex> guard(range.lock);
+	if (range.next == range.end)
+	{
+		return false;
+	}
+	chunkIndex = range.next++;
+	return true;
+}
+
+
+// Steal the back half of the remaining chunks of another worker into the
+// worker's own, empty, range
+inline bool StealChunks(CParallelForState& state, int workerIndex)
+{
+	int numWorkers = state.ranges.size();
+	for (int victimOffset = 1; victimOffset < numWorkers; victimOffset++)
+	{
+		CWorkRange& victim = state.ranges[(workerIndex + victimOffset) % numWorkers];
+		
+		size_t stolenBegin;
+		size_t stolenEnd;
+		{
+			lock_guard<mutex> guard(victim.lock);
+			if (victim.next == victim.end)
+			{
+				continue;
+			}
+			stolenEnd = victim.end;
+			stolenBegin = victim.end - (victim.end - victim.next + 1) / 2;
+			victim.end = stolenBegin;
+		}
+		
+		CWorkRange& range = state.ranges[workerIndex];
+		lock_guard<mutex> guard(range.lock);
+		range.next = stolenBegin;
+		range.end = stolenEnd;
+		return true;
+	}
+	return false;
+}
+
+
+inline void RunParallelForWorker(CParallelForState& state, int workerIndex)
+{
+	do
+	{
+		size_t chunkIndex;
+		while (TakeChunk(state.ranges[workerIndex], chunkIndex))
+		{
+			if (chunkIndex > state.errorChunk)
+			{
+				continue;
+			}
+			
+			try
+			{
+				size_t begin = chunkIndex * state.chunkSize;
+				size_t end = min(state.numItems, begin + state.chunkSize);
+				state.body(begin, end);
+			}
+			catch (...)
+			{
+				lock_guard<mutex> guard(state.errorLock);
+				if (chunkIndex < state.errorChunk)
+				{
+					state.errorChunk = chunkIndex;
+					state.error = current_exception();
+				}
+			}
+		}
+	}
+	while (StealChunks(state, workerIndex));
+}
+
+
+// Persistent threads shared by ParallelFor calls, so that calls do not pay
+// for thread creation.  The pool runs one ParallelFor at a time, its
+// threads joining the calling thread as the other workers, and grows to
+// the largest number of workers requested.  The threads are not copied to a
+// child created by fork, so the pool is only used by the process that
+// created it.
+class CParallelForPool
+{
+public:
+	static CParallelForPool& Get()
+	{
+		static CParallelForPoolOwner owner;
+		return *owner.pool;
+	}
+	
+	~CParallelForPool()
+	{
+		{
+			lock_guard<mutex> guard(mLock);
+			mStopping = true;
+		}
+		mWake.notify_all();
+		for (vector<thread>::iterator threadIter = mThreads.begin(); threadIter != mThreads.end(); threadIter++)
+		{
+			threadIter->join();
+		}
+	}
+	
+	// Run the workers of state, the calling thread being worker 0, returning
+	// false without running any if the pool is already running a ParallelFor
+	// or belongs to the parent of a forked process
+	bool TryRun(CParallelForState& state)
+	{
+		if (getpid() != mProcessID)
+		{
+			return false;
+		}
+		
+		unique_lock<mutex> runGuard(mRunLock, try_to_lock);
+		if (!runGuard.owns_lock())
+		{
+			return false;
+		}
+		
+		{
+			lock_guard<mutex> guard(mLock);
+			int numHelpers = state.ranges.size() - 1;
+			while ((int)mThreads.size() < numHelpers)
+			{
+				mThreads.push_back(thread(&CParallelForPool::RunThread, this, (int)mThreads.size(), mGeneration));
+			}
+			mState = &state;
+			mNumHelpers = numHelpers;
+			mNumRunning = numHelpers;
+			mGeneration++;
+		}
+		mWake.notify_all();
+		
+		RunParallelForWorker(state, 0);
+		
+		unique_lock<mutex> guard(mLock);
+		mDone.wait(guard, [this]{ return mNumRunning == 0; });
+		mState = 0;
+		return true;
+	}
+	
+private:
+	// Destroys the pool at exit in the process that created it.  A forked
+	// child leaves it, as its threads do not exist in the child, which can
+	// neither join them nor destroy the condition variables they wait on.
+	struct CParallelForPoolOwner
+	{
+		CParallelForPoolOwner() : pool(new CParallelForPool()) {}
+		
+		~CParallelForPoolOwner()
+		{
+			if (getpid() == pool->mProcessID)
+			{
+				delete pool;
+			}
+		}
+		
+		CParallelForPool* pool;
+	};
+	
+	CParallelForPool() : mProcessID(getpid()), mState(0), mNumHelpers(0), mNumRunning(0), mGeneration(0), mStopping(false) {}
+	
+	// Pool thread threadIndex runs worker threadIndex + 1 of each ParallelFor
+	// needing it, from the generation after the one it was created in
+	void RunThread(int threadIndex, size_t generation)
+	{
+		unique_lock<mutex> guard(mLock);
+		while (true)
+		{
+			mWake.wait(guard, [&]{ return mGeneration != generation || mStopping; });
+			if (mStopping)
+			{
+				return;
+			}
+			
+			generation = mGeneration;
+			if (threadIndex >= mNumHelpers)
+			{
+				continue;
+			}
+			
+			CParallelForState* state = mState;
+			guard.unlock();
+			RunParallelForWorker(*state, threadIndex + 1);
+			guard.lock();
+			
+			if (--mNumRunning == 0)
+			{
+				mDone.notify_one();
+			}
+		}
+	}
+	
+	// Process owning the threads
+	pid_t mProcessID;
+	
+	// Held for the duration of a ParallelFor run by the pool
+	mutex mRunLock;
+	
+	// Guards the current run and wakes threads for it
+	mutex mLock;
+	condition_variable mWake;
+	condition_variable mDone;
+	CParallelForState* mState;
+	int mNumHelpers;
+	int mNumRunning;
+	size_t mGeneration;
+	bool mStopping;
+	
+	vector<thread> mThreads;
+};
+
+
+// Call body(begin, end) for consecutive chunks of chunkSize items covering
+// [0, numItems) on numThreads threads, 0 for all hardware threads.  Each
+// thread starts with a contiguous share of the chunks, and once its share
+// is done steals half the remaining chunks of another thread.  Threads are
+// taken from the shared pool, or created for the call if the pool is busy
+// or was created before a fork.
+// If body throws, the exception of the lowest throwing chunk is rethrown,
+// so that errors do not depend on the number of threads.
+inline void ParallelFor(size_t numItems, size_t chunkSize, int numThreads, const function<void(size_t,size_t)>& body)
+{
+	if (numThreads <= 0)
+	{
+		numThreads = max(1u, thread::hardware_concurrency());
+	}
+	
+	size_t numChunks = (numItems + chunkSize - 1) / chunkSize;
+	numThreads = (int)min((size_t)numThreads, max((size_t)1, numChunks));
+	
+	CParallelForState state(numItems, chunkSize, numChunks, numThreads, body);
+	
+	if (numThreads == 1)
+	{
+		RunParallelForWorker(state, 0);
+	}
+	else if (!CParallelForPool::Get().TryRun(state))
+	{
+		// The pool is busy with a concurrent or enclosing ParallelFor
+		vector<thread> threads;
+		for (int threadIndex = 0; threadIndex < numThreads; threadIndex++)
+		{
+			threads.push_back(thread(RunParallelForWorker, ref(state), threadIndex));
+		}
+		for (vector<thread>::iterator threadIter = threads.begin(); threadIter != threads.end(); threadIter++)
+		{
+			threadIter->join();
+		}
+	}
+	
+	if (state.error)
+	{
+		rethrow_exception(state.error);
+	}
+}
+
+#endif
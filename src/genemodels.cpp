@@ -1,5 +1,10 @@
 
 #include "IntervalTree/IntervalTree.h"
+#include "IntervalTree/IntervalIndex.h"
+#include "MappedFile.h"
+#include "Gzip.h"
+#include "BinaryStream.h"
+#include "ParallelFor.h"
 
 #include <string>
 #include <sstream>
@@ -8,6 +13,17 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <thread>
+#include <functional>
+#include <string_view>
+#include <charconv>
+#include <type_traits>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
 
 using namespace std;
 
@@ -61,320 +77,2529 @@ struct CGene : public CRegion
 };
 
 
-void splitbytoken(vector<string>& fields, const string& line, char token) 
+// Fields of a single gtf line, referencing the line buffer
+struct CGTFRecord
 {
-	stringstream linestream(line);
-	string intermediate;
-	while(getline(linestream, intermediate, token))
+	string_view chromosome;
+	string_view source;
+	string_view featureType;
+	int start;
+	int end;
+	string_view strand;
+	string_view geneID;
+	string_view transcriptID;
+	string_view geneName;
+};
+
+
+// Split the next token delimited field from the front of text
+string_view NextField(string_view& text, char token)
+{
+	size_t tokenPos = text.find(token);
+	
+	string_view field = text.substr(0, tokenPos);
+	
+	if (tokenPos == string_view::npos)
 	{
-		fields.push_back(intermediate);
+		text = string_view();
 	}
+	else
+	{
+		text.remove_prefix(tokenPos + 1);
+	}
+	
+	return field;
 }
 
 
-template<typename T>
-T lexical_cast(const string& field)
+string_view Trim(string_view field)
 {
-	stringstream fieldstream(field);
+	while (!field.empty() && field.front() == ' ')
+	{
+		field.remove_prefix(1);
+	}
+	
+	while (!field.empty() && field.back() == ' ')
+	{
+		field.remove_suffix(1);
+	}
+	
+	return field;
+}
 
-	T value;
-	fieldstream >> value;
 
-	if (fieldstream.good())
+// Parse an integer field, accepting leading spaces and an explicit plus
+// sign as stream extraction does
+int ParseInt(string_view field)
+{
+	int value = 0;
+	
+	string_view digits = field;
+	while (!digits.empty() && digits.front() == ' ')
+	{
+		digits.remove_prefix(1);
+	}
+	
+	if (digits.size() >= 2 && digits.front() == '+' && digits[1] != '-')
+	{
+		digits.remove_prefix(1);
+	}
+	
+	from_chars_result result = from_chars(digits.data(), digits.data() + digits.size(), value);
+	
+	if (result.ec != errc() || result.ptr != digits.data() + digits.size())
 	{
 		stringstream errorStr;
 		errorStr << "Field " << field << " could not be cast";
 		throw std::invalid_argument(errorStr.str());
 	}
-
+	
 	return value;
 }
 
 
-string trim(string& str)
+// Parse a gtf line into record, returning false for lines with too few fields.
+// Attribute values follow the first space of their attribute, and have
+// surrounding spaces and enclosing double quotes removed, so unquoted values
+// are kept whole.
+bool ParseGTFLine(string_view line, CGTFRecord& record)
 {
-	string::iterator iter1;
-	for (iter1 = str.begin(); iter1 != str.end(); iter1++)
+	string_view fields[9];
+	
+	for (int fieldIndex = 0; fieldIndex < 9; fieldIndex++)
+	{
+		if (line.data() == 0)
+		{
+			return false;
+		}
+		
+		fields[fieldIndex] = NextField(line, '\t');
+	}
+	
+	record.chromosome = fields[0];
+	record.source = fields[1];
+	record.featureType = fields[2];
+	record.start = ParseInt(fields[3]);
+	record.end = ParseInt(fields[4]);
+	record.strand = fields[6];
+	
+	record.geneID = string_view();
+	record.transcriptID = string_view();
+	record.geneName = string_view();
+	
+	string_view attributes = fields[8];
+	while (attributes.data() != 0)
 	{
-		if (*iter1 != ' ')
+		string_view attribute = Trim(NextField(attributes, ';'));
+		
+		if (attribute.empty())
+		{
+			continue;
+		}
+		
+		size_t spacePos = attribute.find(' ');
+		if (spacePos == string_view::npos)
+		{
+			continue;
+		}
+		
+		string_view key = attribute.substr(0, spacePos);
+		string_view value = Trim(attribute.substr(spacePos + 1));
+		
+		if (value.size() >= 2 && value.front() == '"' && value.back() == '"')
+		{
+			value = value.substr(1, value.size() - 2);
+		}
+		
+		if (key == "gene_id")
+		{
+			record.geneID = value;
+		}
+		else if (key == "transcript_id")
 		{
-			break;
+			record.transcriptID = value;
 		}
+		else if (key == "gene_name")
+		{
+			record.geneName = value;
+		}
+	}
+	
+	return true;
+}
+
+
+// Parse a gtf line into record, returning false for header lines, and throwing
+// for empty or malformed lines
+bool ReadGTFLine(string_view line, int lineNumber, const string& gtfFilename, CGTFRecord& record)
+{
+	if (line.substr(0, 2) == "#!")
+	{
+		return false;
+	}
+	
+	if (line.length() == 0)
+	{
+		stringstream errorStr;
+		errorStr << "Empty gtf line " << lineNumber << " of " << gtfFilename;
+		throw std::invalid_argument(errorStr.str());
+	}
+	
+	bool parsed;
+	try
+	{
+		parsed = ParseGTFLine(line, record);
+	}
+	catch (const std::invalid_argument& e)
+	{
+		stringstream errorStr;
+		errorStr << e.what() << " for gtf line " << lineNumber << " of " << gtfFilename;
+		throw std::invalid_argument(errorStr.str());
+	}
+	
+	if (!parsed)
+	{
+		stringstream errorStr;
+		errorStr << "Error: Format error for gtf line " << lineNumber << " of " << gtfFilename;
+		throw std::invalid_argument(errorStr.str());
 	}
+	
+	return true;
+}
+
+
+// Gene fields from the records of one gtf chunk, attributes of the last record
+struct CGTFGeneEntry
+{
+	string_view id;
+	string_view name;
+	string_view source;
+	string_view chromosome;
+	string_view strand;
+	CRegion region;
+};
+
+
+// Transcript features from the records of one gtf chunk, in record order
+struct CGTFTranscriptEntry
+{
+	CGTFTranscriptEntry() : hasStartCodon(false), hasStopCodon(false) {}
+	
+	string_view id;
+	string_view geneID;
+	vector<string_view> geneIDs;
+	vector<CRegion> exons;
+	vector<CRegion> cdss;
+	bool hasStartCodon;
+	CRegion startCodon;
+	bool hasStopCodon;
+	CRegion stopCodon;
+};
+
+
+// Line aligned chunk of a gtf buffer, parsed independently of other chunks
+// into partial gene and transcript tables
+struct CGTFChunk
+{
+	CGTFChunk() : numLines(0), errorLine(0) {}
+	
+	string_view contents;
+	int numLines;
+	
+	// Chunk local number of the first line that failed to parse, or 0
+	int errorLine;
+	string_view errorLineContents;
+	
+	vector<CGTFGeneEntry> genes;
+	vector<CGTFTranscriptEntry> transcripts;
+};
 
-	string::iterator iter2;
-	for (iter2 = str.end(); iter2 != iter1; iter2--)
+
+void ParseGTFChunk(CGTFChunk& chunk, const string& gtfFilename)
+{
+	unordered_map<string_view,unsigned int> geneIndices;
+	unordered_map<string_view,unsigned int> transcriptIndices;
+	
+	CGTFGeneEntry* gene = 0;
+	CGTFTranscriptEntry* transcript = 0;
+	
+	string_view contents = chunk.contents;
+	while (!contents.empty())
 	{
-		if (*iter2 != ' ')
+		chunk.numLines++;
+		
+		string_view line = NextField(contents, '\n');
+		
+		CGTFRecord record;
+		try
+		{
+			if (!ReadGTFLine(line, chunk.numLines, gtfFilename, record))
+			{
+				continue;
+			}
+		}
+		catch (...)
+		{
+			chunk.errorLine = chunk.numLines;
+			chunk.errorLineContents = line;
+			return;
+		}
+		
+		if (gene == 0 || gene->id != record.geneID)
+		{
+			pair<unordered_map<string_view,unsigned int>::iterator,bool> geneInsert = geneIndices.insert(make_pair(record.geneID, (unsigned int)chunk.genes.size()));
+			if (geneInsert.second)
+			{
+				chunk.genes.push_back(CGTFGeneEntry());
+				chunk.genes.back().id = record.geneID;
+				chunk.genes.back().region = CRegion(record.start, record.end);
+			}
+			gene = &chunk.genes[geneInsert.first->second];
+		}
+		
+		gene->name = record.geneName;
+		gene->source = record.source;
+		gene->chromosome = record.chromosome;
+		gene->strand = record.strand;
+		gene->region.start = min(gene->region.start, record.start);
+		gene->region.end = max(gene->region.end, record.end);
+		
+		if (transcript == 0 || transcript->id != record.transcriptID)
+		{
+			pair<unordered_map<string_view,unsigned int>::iterator,bool> transcriptInsert = transcriptIndices.insert(make_pair(record.transcriptID, (unsigned int)chunk.transcripts.size()));
+			if (transcriptInsert.second)
+			{
+				chunk.transcripts.push_back(CGTFTranscriptEntry());
+				chunk.transcripts.back().id = record.transcriptID;
+			}
+			transcript = &chunk.transcripts[transcriptInsert.first->second];
+		}
+		
+		if (transcript->geneIDs.empty() || transcript->geneID != record.geneID)
+		{
+			if (find(transcript->geneIDs.begin(), transcript->geneIDs.end(), record.geneID) == transcript->geneIDs.end())
+			{
+				transcript->geneIDs.push_back(record.geneID);
+			}
+			transcript->geneID = record.geneID;
+		}
+		
+		if (record.featureType == "exon")
+		{
+			transcript->exons.push_back(CRegion(record.start, record.end));
+		}
+		else if (record.featureType == "CDS")
+		{
+			transcript->cdss.push_back(CRegion(record.start, record.end));
+		}
+		else if (record.featureType == "start_codon")
+		{
+			transcript->hasStartCodon = true;
+			transcript->startCodon = CRegion(record.start, record.end);
+		}
+		else if (record.featureType == "stop_codon")
 		{
-			break;
+			transcript->hasStopCodon = true;
+			transcript->stopCodon = CRegion(record.start, record.end);
 		}
 	}
+}
 
-	return string(iter1, iter2);
+
+template<typename TEntry>
+bool EntryIDLess(const TEntry* a, const TEntry* b)
+{
+	return a->id < b->id;
 }
 
 
-class CGeneModels
+template <class T>
+using CColumn = vector<T>;
+
+
+// Location of a position relative to a gene
+enum EGeneLocation
 {
-public:
-	void LoadEnsemblGTF(const string& gtfFilename)
+	UpstreamLocation,
+	DownstreamLocation,
+	CodingLocation,
+	UTR5pLocation,
+	UTR3pLocation,
+	UTRLocation,
+	IntronLocation
+};
+
+const char* GetGeneLocationName(EGeneLocation location)
+{
+	static const char* locationNames[] = {"upstream", "downstream", "coding", "utr5p", "utr3p", "utr", "intron"};
+	return locationNames[location];
+}
+
+// Genes searched by k nearest gene queries, by whether they lie upstream or
+// downstream of the position relative to the gene strand
+enum ENearestDirection
+{
+	AnyNearestDirection,
+	UpstreamNearestDirection,
+	DownstreamNearestDirection
+};
+
+
+// Columnar gene model tables, either owned as vectors or viewing the columns
+// of a mapped image.  Strings are stored once in a shared pool and referenced
+// by index.  Genes are indexed by ordinal and each owns a contiguous range of
+// transcript rows in transcript id order, and each transcript row owns
+// contiguous ranges of the exon and CDS pools.  The location of positions
+// within each gene is precomputed as a range of segments of constant location,
+// each starting at a position and extending to the start of the next.  The
+// same is precomputed genome wide as annotation segments per chromosome, each
+// listing the genes overlapping it and the location within each gene.  Gene
+// intervals are listed per chromosome in start order, and indexed by a flat
+// interval tree per chromosome, with node and interval indices relative to
+// the chromosome's ranges of the shared node and interval pools.
+template <template <class> class TArray>
+struct CGeneModelTables
+{
+	enum ETranscriptFlags
+	{
+		HasStartCodon = 1,
+		HasStopCodon = 2
+	};
+	
+	TArray<uint64_t> stringOffsets;
+	TArray<char> stringData;
+	
+	TArray<uint32_t> geneID;
+	TArray<uint32_t> geneName;
+	TArray<uint32_t> geneSource;
+	TArray<uint32_t> geneStrand;
+	TArray<int> geneChromosome;
+	TArray<int> geneStart;
+	TArray<int> geneEnd;
+	TArray<uint32_t> geneTranscriptOffsets;
+	
+	TArray<uint32_t> transcriptID;
+	TArray<uint32_t> transcriptGene;
+	TArray<int> transcriptLength;
+	TArray<unsigned char> transcriptFlags;
+	TArray<CRegion> transcriptStartCodon;
+	TArray<CRegion> transcriptStopCodon;
+	TArray<uint32_t> transcriptExonOffsets;
+	TArray<uint32_t> transcriptCDSOffsets;
+	TArray<CRegion> exons;
+	TArray<CRegion> cdss;
+	
+	TArray<uint32_t> geneSegmentOffsets;
+	TArray<int> segmentStart;
+	TArray<unsigned char> segmentLocation;
+	
+	TArray<uint32_t> chromosomeAnnotationOffsets;
+	TArray<int> annotationStart;
+	TArray<uint32_t> annotationGeneOffsets;
+	TArray<uint32_t> annotationGene;
+	TArray<unsigned char> annotationLocation;
+	
+	// Transcript ids in id order, with the row of the transcript in its gene
+	TArray<uint32_t> transcriptIndexID;
+	TArray<uint32_t> transcriptIndexRow;
+	
+	TArray<uint32_t> chromosomeName;
+	TArray<uint32_t> chromosomeGeneOffsets;
+	TArray<CInterval<uint32_t> > chromosomeGenes;
+	TArray<uint32_t> chromosomeNodeOffsets;
+	TArray<uint32_t> chromosomeIntervalOffsets;
+	TArray<CFlatIntervalNode> treeNodes;
+	TArray<CInterval<uint32_t> > treeIntervals;
+	
+	// Apply visitor to each column in a fixed order, which is also the
+	// order of columns in an image
+	template <class TTables, class TVisitor>
+	static void VisitColumns(TTables& tables, TVisitor& visitor)
+	{
+		visitor(tables.stringOffsets);
+		visitor(tables.stringData);
+		visitor(tables.geneID);
+		visitor(tables.geneName);
+		visitor(tables.geneSource);
+		visitor(tables.geneStrand);
+		visitor(tables.geneChromosome);
+		visitor(tables.geneStart);
+		visitor(tables.geneEnd);
+		visitor(tables.geneTranscriptOffsets);
+		visitor(tables.transcriptID);
+		visitor(tables.transcriptGene);
+		visitor(tables.transcriptLength);
+		visitor(tables.transcriptFlags);
+		visitor(tables.transcriptStartCodon);
+		visitor(tables.transcriptStopCodon);
+		visitor(tables.transcriptExonOffsets);
+		visitor(tables.transcriptCDSOffsets);
+		visitor(tables.exons);
+		visitor(tables.cdss);
+		visitor(tables.geneSegmentOffsets);
+		visitor(tables.segmentStart);
+		visitor(tables.segmentLocation);
+		visitor(tables.chromosomeAnnotationOffsets);
+		visitor(tables.annotationStart);
+		visitor(tables.annotationGeneOffsets);
+		visitor(tables.annotationGene);
+		visitor(tables.annotationLocation);
+		visitor(tables.transcriptIndexID);
+		visitor(tables.transcriptIndexRow);
+		visitor(tables.chromosomeName);
+		visitor(tables.chromosomeGeneOffsets);
+		visitor(tables.chromosomeGenes);
+		visitor(tables.chromosomeNodeOffsets);
+		visitor(tables.chromosomeIntervalOffsets);
+		visitor(tables.treeNodes);
+		visitor(tables.treeIntervals);
+	}
+	
+	string_view GetString(uint32_t stringRef) const
+	{
+		return string_view(stringData.data() + stringOffsets[stringRef], stringOffsets[stringRef + 1] - stringOffsets[stringRef]);
+	}
+	
+	int FindGene(string_view id) const
+	{
+		return FindString(geneID, id);
+	}
+	
+	int FindTranscript(string_view id) const
+	{
+		int index = FindString(transcriptIndexID, id);
+		return (index < 0) ? -1 : (int)transcriptIndexRow[index];
+	}
+	
+	int FindChromosome(string_view name) const
+	{
+		return FindString(chromosomeName, name);
+	}
+	
+	CGene GetGene(uint32_t geneOrdinal) const
+	{
+		CGene gene;
+		gene.id = GetString(geneID[geneOrdinal]);
+		gene.name = GetString(geneName[geneOrdinal]);
+		gene.source = GetString(geneSource[geneOrdinal]);
+		gene.chromosome = GetString(chromosomeName[geneChromosome[geneOrdinal]]);
+		gene.strand = GetString(geneStrand[geneOrdinal]);
+		gene.start = geneStart[geneOrdinal];
+		gene.end = geneEnd[geneOrdinal];
+		return gene;
+	}
+	
+	CFlatIntervalTreeView<uint32_t> GetGeneIntervalTree(int chromosomeID) const
+	{
+		CArrayView<CFlatIntervalNode> nodes(treeNodes.data() + chromosomeNodeOffsets[chromosomeID],
+											chromosomeNodeOffsets[chromosomeID + 1] - chromosomeNodeOffsets[chromosomeID]);
+		CArrayView<CInterval<uint32_t> > intervals(treeIntervals.data() + chromosomeIntervalOffsets[chromosomeID],
+												   chromosomeIntervalOffsets[chromosomeID + 1] - chromosomeIntervalOffsets[chromosomeID]);
+		return CFlatIntervalTreeView<uint32_t>(nodes, intervals);
+	}
+	
+	CArrayView<CRegion> GetExons(uint32_t transcriptRow) const
+	{
+		return CArrayView<CRegion>(exons.data() + transcriptExonOffsets[transcriptRow],
+								   transcriptExonOffsets[transcriptRow + 1] - transcriptExonOffsets[transcriptRow]);
+	}
+	
+	CArrayView<CRegion> GetCDSs(uint32_t transcriptRow) const
+	{
+		return CArrayView<CRegion>(cdss.data() + transcriptCDSOffsets[transcriptRow],
+								   transcriptCDSOffsets[transcriptRow + 1] - transcriptCDSOffsets[transcriptRow]);
+	}
+	
+	// Location of position relative to a gene, a gene ordinal of -1 giving
+	// the location relative to an unknown gene
+	EGeneLocation CalculateGeneLocation(int geneOrdinal, int position) const
 	{
-		map<string, vector<int> > geneRegionStart;
-		map<string, vector<int> > geneRegionEnd;
+		if (geneOrdinal < 0)
+		{
+			return IntronLocation;
+		}
 		
-		// Open clusters file
-		ifstream gtfFile(gtfFilename.c_str());
-		if (!gtfFile)
+		string_view strand = GetString(geneStrand[geneOrdinal]);
+		int start = geneStart[geneOrdinal];
+		int end = geneEnd[geneOrdinal];
+		
+		if ((position < start && strand == "+") || (position > end && strand == "-"))
 		{
-			stringstream errorStr;
-			errorStr << "File " << gtfFilename << " not found";
-			throw std::invalid_argument(errorStr.str());
+			return UpstreamLocation;
+		}
+		
+		if ((position > end && strand == "+") || (position < start && strand == "-"))
+		{
+			return DownstreamLocation;
+		}
+		
+		// Last segment starting at or before position
+		const int* segmentsBegin = segmentStart.data() + geneSegmentOffsets[geneOrdinal];
+		const int* segmentsEnd = segmentStart.data() + geneSegmentOffsets[geneOrdinal + 1];
+		const int* segmentIter = upper_bound(segmentsBegin, segmentsEnd, position);
+		
+		if (segmentIter == segmentsBegin)
+		{
+			return IntronLocation;
+		}
+		
+		return (EGeneLocation)segmentLocation[segmentIter - 1 - segmentStart.data()];
+	}
+	
+	// Append the genes overlapping position, in gene ordinal order, and the
+	// location of position within each
+	void AnnotatePosition(int chromosomeID, int position, vector<uint32_t>& geneOrdinals, vector<EGeneLocation>& locations) const
+	{
+		// Last annotation segment starting at or before position
+		const int* annotationsBegin = annotationStart.data() + chromosomeAnnotationOffsets[chromosomeID];
+		const int* annotationsEnd = annotationStart.data() + chromosomeAnnotationOffsets[chromosomeID + 1];
+		const int* annotationIter = upper_bound(annotationsBegin, annotationsEnd, position);
+		
+		if (annotationIter == annotationsBegin)
+		{
+			return;
+		}
+		
+		size_t annotationIndex = annotationIter - 1 - annotationStart.data();
+		for (uint32_t geneIndex = annotationGeneOffsets[annotationIndex]; geneIndex != annotationGeneOffsets[annotationIndex + 1]; geneIndex++)
+		{
+			geneOrdinals.push_back(annotationGene[geneIndex]);
+			locations.push_back((EGeneLocation)annotationLocation[geneIndex]);
+		}
+	}
+	
+	// Genomic position of a position in the spliced transcript, which must
+	// have at least one exon
+	int CalculateGenomicPosition(uint32_t transcriptRow, int position) const
+	{
+		CArrayView<CRegion> transcriptExons = GetExons(transcriptRow);
+		
+		if (GetString(geneStrand[transcriptGene[transcriptRow]]) == "-")
+		{
+			position = transcriptLength[transcriptRow] - position + 1;
+		}
+		
+		if (position < 1)
+		{
+			return transcriptExons.front().start + position - 1;
+		}
+		
+		int localOffset = 0;
+		for (CArrayView<CRegion>::const_iterator exonIter = transcriptExons.begin(); exonIter != transcriptExons.end(); exonIter++)
+		{
+			int exonSize = exonIter->end - exonIter->start + 1;
+			
+			if (position <= localOffset + exonSize)
+			{
+				return position - localOffset - 1 + exonIter->start;
+			}
+			
+			localOffset += exonSize;
+		}
+		
+		return position - localOffset + transcriptExons.back().end;
+	}
+	
+	// Genomic regions of a range of the spliced transcript, which must have
+	// at least one exon
+	void CalculateGenomicRegions(uint32_t transcriptRow, int start, int end, vector<CRegion>& regions) const
+	{
+		CArrayView<CRegion> transcriptExons = GetExons(transcriptRow);
+		int length = transcriptLength[transcriptRow];
+		
+		if (GetString(geneStrand[transcriptGene[transcriptRow]]) == "-")
+		{
+			int tmpStart = length - end + 1;
+			int tmpEnd = length - start + 1;
+			
+			start = tmpStart;
+			end = tmpEnd;
+		}
+		
+		if (start < 1)
+		{
+			regions.push_back(CRegion(transcriptExons.front().start, transcriptExons.front().start));
+			return;
+		}
+		
+		if (end > length)
+		{
+			regions.push_back(CRegion(transcriptExons.back().end, transcriptExons.back().end));
+			return;
+		}
+		
+		int localOffset = 0;
+		for (CArrayView<CRegion>::const_iterator exonIter = transcriptExons.begin(); exonIter != transcriptExons.end(); exonIter++)
+		{
+			int localStart = start - localOffset;
+			int localEnd = end - localOffset;
+			
+			int overlapStart = max(1, localStart) + exonIter->start - 1;
+			int overlapEnd = min(exonIter->GetLength(), localEnd) + exonIter->start - 1;
+			
+			if (overlapStart <= overlapEnd)
+			{
+				regions.push_back(CRegion(overlapStart, overlapEnd));
+			}
+			
+			localOffset += exonIter->GetLength();
+		}
+	}
+	
+	// Check the sizes of the columns against each other, and that all offsets
+	// and references are in range, without reading the pools themselves
+	bool IsValid() const
+	{
+		size_t numGenes = geneID.size();
+		size_t numTranscripts = transcriptID.size();
+		size_t numChromosomes = chromosomeName.size();
+		
+		if (!IsValidOffsets(stringOffsets, stringOffsets.empty() ? 0 : stringOffsets.size() - 1, stringData.size()) || stringOffsets.empty())
+		{
+			return false;
+		}
+		
+		size_t numStrings = stringOffsets.size() - 1;
+		
+		if (geneName.size() != numGenes || geneSource.size() != numGenes || geneStrand.size() != numGenes ||
+			geneChromosome.size() != numGenes || geneStart.size() != numGenes || geneEnd.size() != numGenes ||
+			!IsValidOffsets(geneTranscriptOffsets, numGenes, numTranscripts))
+		{
+			return false;
+		}
+		
+		if (transcriptGene.size() != numTranscripts || transcriptLength.size() != numTranscripts ||
+			transcriptFlags.size() != numTranscripts || transcriptStartCodon.size() != numTranscripts ||
+			transcriptStopCodon.size() != numTranscripts ||
+			!IsValidOffsets(transcriptExonOffsets, numTranscripts, exons.size()) ||
+			!IsValidOffsets(transcriptCDSOffsets, numTranscripts, cdss.size()) ||
+			!IsValidOffsets(geneSegmentOffsets, numGenes, segmentStart.size()) || segmentLocation.size() != segmentStart.size() ||
+			!IsValidOffsets(annotationGeneOffsets, annotationStart.size(), annotationGene.size()) ||
+			annotationLocation.size() != annotationGene.size() ||
+			transcriptIndexRow.size() != transcriptIndexID.size())
+		{
+			return false;
+		}
+		
+		if (!IsValidOffsets(chromosomeAnnotationOffsets, numChromosomes, annotationStart.size()) ||
+			!IsValidOffsets(chromosomeGeneOffsets, numChromosomes, chromosomeGenes.size()) ||
+			!IsValidOffsets(chromosomeNodeOffsets, numChromosomes, treeNodes.size()) ||
+			!IsValidOffsets(chromosomeIntervalOffsets, numChromosomes, treeIntervals.size()))
+		{
+			return false;
+		}
+		
+		if (!IsValidRefs(geneID, numStrings) || !IsValidRefs(geneName, numStrings) || !IsValidRefs(geneSource, numStrings) ||
+			!IsValidRefs(geneStrand, numStrings) || !IsValidRefs(transcriptID, numStrings) ||
+			!IsValidRefs(transcriptIndexID, numStrings) || !IsValidRefs(chromosomeName, numStrings) ||
+			!IsValidRefs(transcriptGene, numGenes) || !IsValidRefs(transcriptIndexRow, numTranscripts) ||
+			!IsValidRefs(annotationGene, numGenes))
+		{
+			return false;
+		}
+		
+		for (size_t geneOrdinal = 0; geneOrdinal < numGenes; geneOrdinal++)
+		{
+			if (geneChromosome[geneOrdinal] < 0 || geneChromosome[geneOrdinal] >= (int)numChromosomes)
+			{
+				return false;
+			}
+		}
+		
+		for (size_t segmentIndex = 0; segmentIndex < segmentLocation.size(); segmentIndex++)
+		{
+			if (segmentLocation[segmentIndex] > IntronLocation)
+			{
+				return false;
+			}
+		}
+		
+		for (size_t geneIndex = 0; geneIndex < annotationLocation.size(); geneIndex++)
+		{
+			if (annotationLocation[geneIndex] > IntronLocation)
+			{
+				return false;
+			}
+		}
+		
+		for (size_t intervalIndex = 0; intervalIndex < treeIntervals.size(); intervalIndex++)
+		{
+			if (treeIntervals[intervalIndex].value >= numGenes)
+			{
+				return false;
+			}
+		}
+		
+		for (size_t geneIndex = 0; geneIndex < chromosomeGenes.size(); geneIndex++)
+		{
+			if (chromosomeGenes[geneIndex].value >= numGenes)
+			{
+				return false;
+			}
+		}
+		
+		for (size_t chromosomeID = 0; chromosomeID < numChromosomes; chromosomeID++)
+		{
+			if (!GetGeneIntervalTree(chromosomeID).IsValid())
+			{
+				return false;
+			}
+		}
+		
+		return true;
+	}
+	
+private:
+	// Index of value in the sorted strings referenced by stringRefs, or -1
+	int FindString(const TArray<uint32_t>& stringRefs, string_view value) const
+	{
+		size_t lower = 0;
+		size_t upper = stringRefs.size();
+		while (lower < upper)
+		{
+			size_t middle = lower + (upper - lower) / 2;
+			if (GetString(stringRefs[middle]) < value)
+			{
+				lower = middle + 1;
+			}
+			else
+			{
+				upper = middle;
+			}
+		}
+		
+		if (lower == stringRefs.size() || GetString(stringRefs[lower]) != value)
+		{
+			return -1;
+		}
+		
+		return lower;
+	}
+	
+	template <class TOffset>
+	static bool IsValidOffsets(const TArray<TOffset>& offsets, size_t count, size_t poolSize)
+	{
+		if (offsets.size() != count + 1)
+		{
+			return false;
+		}
+		
+		for (size_t index = 0; index < count; index++)
+		{
+			if (offsets[index] > offsets[index + 1])
+			{
+				return false;
+			}
+		}
+		
+		return offsets.back() <= poolSize;
+	}
+	
+	static bool IsValidRefs(const TArray<uint32_t>& refs, size_t count)
+	{
+		for (size_t index = 0; index < refs.size(); index++)
+		{
+			if (refs[index] >= count)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+
+// Write each column of tables to a binary snapshot
+struct CBinaryColumnWriter
+{
+	CBinaryColumnWriter(CBinaryWriter& writer) : writer(writer) {}
+	
+	template <class TArray>
+	void operator()(const TArray& column)
+	{
+		writer.WriteArray(column.data(), column.size());
+	}
+	
+	CBinaryWriter& writer;
+};
+
+
+// Read each column of owned tables from a binary snapshot
+struct CBinaryColumnReader
+{
+	CBinaryColumnReader(CBinaryReader& reader) : reader(reader) {}
+	
+	template <class T>
+	void operator()(vector<T>& column)
+	{
+		reader.Read(column);
+	}
+	
+	CBinaryReader& reader;
+};
+
+
+// Point the columns of a view at the columns of owned tables, visiting the
+// owned tables first
+struct CColumnViewBuilder
+{
+	CColumnViewBuilder() : columnIndex(0) {}
+	
+	template <class T>
+	void operator()(const vector<T>& column)
+	{
+		columns.push_back(make_pair(static_cast<const void*>(column.data()), column.size()));
+	}
+	
+	template <class T>
+	void operator()(CArrayView<T>& column)
+	{
+		column = CArrayView<T>(static_cast<const T*>(columns[columnIndex].first), columns[columnIndex].second);
+		columnIndex++;
+	}
+	
+	vector<pair<const void*,size_t> > columns;
+	size_t columnIndex;
+};
+
+
+// Header of a gene models image, followed by a table of column extents and
+// the columns themselves.  Column offsets are relative to the start of the
+// image, which can therefore be mapped at any address.
+struct CImageHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t numColumns;
+	uint32_t reserved;
+};
+
+struct CImageColumn
+{
+	uint64_t offset;
+	uint64_t size;
+	uint32_t elementSize;
+	uint32_t reserved;
+};
+
+const char ImageMagic[8] = {'P', 'Y', 'G', 'E', 'N', 'E', 'S', 'I'};
+const uint32_t ImageVersion = 4;
+const size_t ImageColumnAlignment = 64;
+
+
+// Collect the extents of each column of tables for writing an image
+struct CImageColumnWriter
+{
+	template <class TArray>
+	void operator()(const TArray& column)
+	{
+		typedef typename remove_reference<decltype(column[0])>::type TElement;
+		
+		CImageColumn imageColumn = CImageColumn();
+		imageColumn.size = column.size();
+		imageColumn.elementSize = sizeof(TElement);
+		columns.push_back(imageColumn);
+		data.push_back(reinterpret_cast<const char*>(column.data()));
+	}
+	
+	vector<CImageColumn> columns;
+	vector<const char*> data;
+};
+
+
+// Point each column of mapped tables at its extent of an image, throwing if
+// the extent does not fit the image or the column's element type
+struct CImageColumnReader
+{
+	CImageColumnReader(string_view image, const CImageColumn* columns, uint32_t numColumns)
+	: image(image), columns(columns), numColumns(numColumns), columnIndex(0)
+	{}
+	
+	template <class T>
+	void operator()(CArrayView<T>& column)
+	{
+		if (columnIndex >= numColumns)
+		{
+			throw std::out_of_range("missing columns");
+		}
+		
+		const CImageColumn& imageColumn = columns[columnIndex++];
+		
+		if (imageColumn.elementSize != sizeof(T) || imageColumn.offset % alignof(T) != 0 ||
+			imageColumn.offset > image.size() || imageColumn.size > (image.size() - imageColumn.offset) / sizeof(T))
+		{
+			throw std::out_of_range("invalid column extent");
+		}
+		
+		column = CArrayView<T>(reinterpret_cast<const T*>(image.data() + imageColumn.offset), imageColumn.size);
+	}
+	
+	string_view image;
+	const CImageColumn* columns;
+	uint32_t numColumns;
+	uint32_t columnIndex;
+};
+
+
+// Header of a binary gene models file, followed by the payload it describes.
+// The byte order check rejects files written on a host of different endianness.
+struct CBinaryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t payloadSize;
+	uint32_t payloadCRC;
+	uint32_t reserved;
+};
+
+const char BinaryMagic[8] = {'P', 'Y', 'G', 'E', 'N', 'E', 'S', 'B'};
+const uint32_t BinaryVersion = 9;
+const uint32_t ByteOrderCheck = 0x01020304;
+
+
+// Gene models queried by gene, transcript and genomic position.  Loading
+// replaces the model, and must not overlap other calls.  Queries are const
+// and do not modify the model, so may be made concurrently from any number
+// of threads.
+class CGeneModels
+{
+public:
+	CGeneModels(EIntervalEngine intervalEngine = IntervalTreeEngine) : mIntervalEngine(intervalEngine) {}
+	
+	// Moving keeps the owned columns' storage, and so the view of them
+	CGeneModels(CGeneModels&&) = default;
+	CGeneModels& operator=(CGeneModels&&) = default;
+	
+	// Load an ensembl gtf, optionally parsing from a memory mapping of the file,
+	// and with numThreads parser threads, 0 for all hardware threads.  Gzip and
+	// BGZF compressed files are detected and decompressed.
+	void LoadEnsemblGTF(const string& gtfFilename, bool memoryMap = false, int numThreads = 1)
+	{
+		if (numThreads <= 0)
+		{
+			numThreads = max(1u, thread::hardware_concurrency());
+		}
+		
+		if (memoryMap)
+		{
+			CMappedFile gtfFile;
+			gtfFile.Open(gtfFilename);
+			gtfFile.Advise(MADV_SEQUENTIAL);
+			
+			LoadEnsemblGTFContents(string_view(gtfFile.GetData(), gtfFile.GetSize()), gtfFilename, numThreads);
+			return;
+		}
+		
+		// Open clusters file
+		ifstream gtfFile(gtfFilename.c_str());
+		if (!gtfFile)
+		{
+			stringstream errorStr;
+			errorStr << "File " << gtfFilename << " not found";
+			throw std::invalid_argument(errorStr.str());
+		}
+		
+		char magic[2] = {0, 0};
+		gtfFile.read(magic, 2);
+		gtfFile.clear();
+		gtfFile.seekg(0);
+		
+		// Compressed files and parallel parsing require the whole file in memory
+		if (IsGzip(string_view(magic, 2)) || numThreads > 1)
+		{
+			string gtfContents((istreambuf_iterator<char>(gtfFile)), istreambuf_iterator<char>());
+			
+			LoadEnsemblGTFContents(gtfContents, gtfFilename, numThreads);
+			return;
+		}
+		
+		CGTFLoadState loadState;
+		
+		// Parse file contents
+		string line;
+		int lineNumber = 0;
+		while (getline(gtfFile, line))
+		{
+			lineNumber++;
+			AddGTFLine(line, lineNumber, gtfFilename, loadState);
+		}
+		
+		FinishGTFLoad(loadState);
+	}
+	
+	// Load gtf file contents, decompressing if gzip compressed
+	void LoadEnsemblGTFContents(string_view gtfContents, const string& gtfFilename, int numThreads = 1)
+	{
+		if (IsGzip(gtfContents))
+		{
+			string decompressedContents;
+			try
+			{
+				DecompressGzip(gtfContents, decompressedContents, numThreads);
+			}
+			catch (const std::runtime_error& e)
+			{
+				stringstream errorStr;
+				errorStr << e.what() << " in " << gtfFilename;
+				throw std::invalid_argument(errorStr.str());
+			}
+			
+			LoadEnsemblGTFBuffer(decompressedContents, gtfFilename, numThreads);
+		}
+		else
+		{
+			LoadEnsemblGTFBuffer(gtfContents, gtfFilename, numThreads);
+		}
+	}
+	
+	// Load gtf contents split at line boundaries into one chunk per thread.
+	// Chunks are parsed concurrently and merged in file order, giving the
+	// same model as loading line by line.
+	void LoadEnsemblGTFBuffer(string_view gtfContents, const string& gtfFilename, int numThreads = 1)
+	{
+		vector<CGTFChunk> chunks(numThreads);
+		
+		size_t chunkStart = 0;
+		for (int chunkIndex = 0; chunkIndex < numThreads; chunkIndex++)
+		{
+			size_t chunkEnd = gtfContents.size() * (chunkIndex + 1) / numThreads;
+			
+			if (chunkEnd < chunkStart)
+			{
+				chunkEnd = chunkStart;
+			}
+			
+			if (chunkEnd < gtfContents.size())
+			{
+				chunkEnd = gtfContents.find('\n', chunkEnd);
+				chunkEnd = (chunkEnd == string_view::npos) ? gtfContents.size() : chunkEnd + 1;
+			}
+			
+			chunks[chunkIndex].contents = gtfContents.substr(chunkStart, chunkEnd - chunkStart);
+			chunkStart = chunkEnd;
+		}
+		
+		if (numThreads == 1)
+		{
+			ParseGTFChunk(chunks.front(), gtfFilename);
+		}
+		else
+		{
+			vector<thread> threads;
+			for (int chunkIndex = 0; chunkIndex < numThreads; chunkIndex++)
+			{
+				threads.push_back(thread(ParseGTFChunk, ref(chunks[chunkIndex]), cref(gtfFilename)));
+			}
+			for (vector<thread>::iterator threadIter = threads.begin(); threadIter != threads.end(); threadIter++)
+			{
+				threadIter->join();
+			}
+		}
+		
+		// Report the first malformed line of the file, as a line by line load would
+		int lineOffset = 0;
+		for (vector<CGTFChunk>::const_iterator chunkIter = chunks.begin(); chunkIter != chunks.end(); chunkIter++)
+		{
+			if (chunkIter->errorLine != 0)
+			{
+				CGTFRecord record;
+				ReadGTFLine(chunkIter->errorLineContents, lineOffset + chunkIter->errorLine, gtfFilename, record);
+			}
+			lineOffset += chunkIter->numLines;
+		}
+		
+		CGTFLoadState loadState;
+		MergeGTFChunks(chunks, loadState);
+		FinishGTFLoad(loadState);
+	}
+	
+	// Save the model's tables, including the flat gene interval trees, so
+	// that it can be restored by LoadBinary without parsing the gtf.  Trees
+	// of other engines are rebuilt from the tables on load.
+	void SaveBinary(const string& binaryFilename) const
+	{
+		CBinaryWriter writer;
+		writer.Write((int)mIntervalEngine);
+		
+		CBinaryColumnWriter columnWriter(writer);
+		CGeneModelTables<CArrayView>::VisitColumns(mTables, columnWriter);
+		
+		const string& payload = writer.GetData();
+		
+		CBinaryHeader header = CBinaryHeader();
+		copy(BinaryMagic, BinaryMagic + sizeof(BinaryMagic), header.magic);
+		header.version = BinaryVersion;
+		header.byteOrder = ByteOrderCheck;
+		header.payloadSize = payload.size();
+		header.payloadCRC = CalculateCRC32(payload);
+		
+		ofstream binaryFile(binaryFilename.c_str(), ios::binary);
+		binaryFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		binaryFile.write(payload.data(), payload.size());
+		binaryFile.close();
+		
+		if (!binaryFile)
+		{
+			stringstream errorStr;
+			errorStr << "Unable to write file " << binaryFilename;
+			throw std::invalid_argument(errorStr.str());
+		}
+	}
+	
+	// Replace the model with one saved by SaveBinary, including the interval
+	// engine it was saved with.  The model is unchanged if the file is invalid.
+	void LoadBinary(const string& binaryFilename)
+	{
+		CMappedFile binaryFile;
+		binaryFile.Open(binaryFilename);
+		
+		string_view contents(binaryFile.GetData(), binaryFile.GetSize());
+		
+		CBinaryHeader header;
+		if (contents.size() < sizeof(header))
+		{
+			ThrowInvalidFile("binary", binaryFilename, "truncated header");
+		}
+		memcpy(&header, contents.data(), sizeof(header));
+		
+		string_view payload = contents.substr(sizeof(header));
+		
+		if (!equal(BinaryMagic, BinaryMagic + sizeof(BinaryMagic), header.magic))
+		{
+			ThrowInvalidFile("binary", binaryFilename, "not a gene models binary");
+		}
+		if (header.version != BinaryVersion)
+		{
+			ThrowInvalidFile("binary", binaryFilename, "unsupported version");
+		}
+		if (header.byteOrder != ByteOrderCheck)
+		{
+			ThrowInvalidFile("binary", binaryFilename, "incompatible byte order");
+		}
+		if (header.payloadSize != payload.size())
+		{
+			ThrowInvalidFile("binary", binaryFilename, "truncated data");
+		}
+		if (header.payloadCRC != CalculateCRC32(payload))
+		{
+			ThrowInvalidFile("binary", binaryFilename, "checksum mismatch");
+		}
+		
+		CGeneModels geneModels;
+		try
+		{
+			CBinaryReader reader(payload);
+			
+			int intervalEngine;
+			reader.Read(intervalEngine);
+			if (intervalEngine < IntervalTreeEngine || intervalEngine > AIListEngine)
+			{
+				throw std::out_of_range("invalid interval engine");
+			}
+			geneModels.mIntervalEngine = (EIntervalEngine)intervalEngine;
+			
+			CBinaryColumnReader columnReader(reader);
+			CGeneModelTables<CColumn>::VisitColumns(geneModels.mOwnedTables, columnReader);
+			
+			if (!reader.AtEnd())
+			{
+				throw std::out_of_range("trailing data");
+			}
+		}
+		catch (const std::out_of_range& e)
+		{
+			ThrowInvalidFile("binary", binaryFilename, e.what());
+		}
+		
+		geneModels.UpdateTables();
+		
+		if (!geneModels.mTables.IsValid())
+		{
+			ThrowInvalidFile("binary", binaryFilename, "inconsistent tables");
+		}
+		
+		geneModels.BuildGeneIntervalTrees();
+		
+		*this = std::move(geneModels);
+	}
+	
+	// Save the model as an image of columnar tables addressed by offset,
+	// which OpenImage maps read only and queries in place
+	void SaveImage(const string& imageFilename) const
+	{
+		CImageColumnWriter columnWriter;
+		CGeneModelTables<CArrayView>::VisitColumns(mTables, columnWriter);
+		
+		CImageHeader header = CImageHeader();
+		copy(ImageMagic, ImageMagic + sizeof(ImageMagic), header.magic);
+		header.version = ImageVersion;
+		header.byteOrder = ByteOrderCheck;
+		header.numColumns = columnWriter.columns.size();
+		
+		uint64_t offset = sizeof(header) + columnWriter.columns.size() * sizeof(CImageColumn);
+		for (vector<CImageColumn>::iterator columnIter = columnWriter.columns.begin(); columnIter != columnWriter.columns.end(); columnIter++)
+		{
+			offset = (offset + ImageColumnAlignment - 1) / ImageColumnAlignment * ImageColumnAlignment;
+			columnIter->offset = offset;
+			offset += columnIter->size * columnIter->elementSize;
+		}
+		
+		ofstream imageFile(imageFilename.c_str(), ios::binary);
+		imageFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		imageFile.write(reinterpret_cast<const char*>(columnWriter.columns.data()), columnWriter.columns.size() * sizeof(CImageColumn));
+		
+		const char padding[ImageColumnAlignment] = {};
+		offset = sizeof(header) + columnWriter.columns.size() * sizeof(CImageColumn);
+		for (size_t columnIndex = 0; columnIndex < columnWriter.columns.size(); columnIndex++)
+		{
+			const CImageColumn& column = columnWriter.columns[columnIndex];
+			
+			imageFile.write(padding, column.offset - offset);
+			imageFile.write(columnWriter.data[columnIndex], column.size * column.elementSize);
+			
+			offset = column.offset + column.size * column.elementSize;
+		}
+		
+		imageFile.close();
+		
+		if (!imageFile)
+		{
+			stringstream errorStr;
+			errorStr << "Unable to write file " << imageFilename;
+			throw std::invalid_argument(errorStr.str());
+		}
+	}
+	
+	// Replace the model with a read only mapping of an image saved by
+	// SaveImage.  Queries run directly on the mapped columns, so processes
+	// opening the same image share its pages.  The image file must not be
+	// modified while open.  The model is unchanged if the image is invalid.
+	void OpenImage(const string& imageFilename)
+	{
+		shared_ptr<CMappedFile> imageFile(new CMappedFile());
+		imageFile->Open(imageFilename);
+		
+		string_view image(imageFile->GetData(), imageFile->GetSize());
+		
+		CImageHeader header;
+		if (image.size() < sizeof(header))
+		{
+			ThrowInvalidFile("image", imageFilename, "truncated header");
+		}
+		memcpy(&header, image.data(), sizeof(header));
+		
+		if (!equal(ImageMagic, ImageMagic + sizeof(ImageMagic), header.magic))
+		{
+			ThrowInvalidFile("image", imageFilename, "not a gene models image");
+		}
+		if (header.version != ImageVersion)
+		{
+			ThrowInvalidFile("image", imageFilename, "unsupported version");
+		}
+		if (header.byteOrder != ByteOrderCheck)
+		{
+			ThrowInvalidFile("image", imageFilename, "incompatible byte order");
+		}
+		if (header.numColumns > (image.size() - sizeof(header)) / sizeof(CImageColumn))
+		{
+			ThrowInvalidFile("image", imageFilename, "truncated column table");
+		}
+		
+		const CImageColumn* columns = reinterpret_cast<const CImageColumn*>(image.data() + sizeof(header));
+		
+		CGeneModelTables<CArrayView> tables;
+		try
+		{
+			CImageColumnReader columnReader(image, columns, header.numColumns);
+			CGeneModelTables<CArrayView>::VisitColumns(tables, columnReader);
+			
+			if (columnReader.columnIndex != header.numColumns)
+			{
+				throw std::out_of_range("unexpected columns");
+			}
+		}
+		catch (const std::out_of_range& e)
+		{
+			ThrowInvalidFile("image", imageFilename, e.what());
+		}
+		
+		if (!tables.IsValid())
+		{
+			ThrowInvalidFile("image", imageFilename, "inconsistent tables");
+		}
+		
+		*this = CGeneModels(mIntervalEngine);
+		mImageFile = imageFile;
+		mTables = tables;
+		
+		BuildGeneIntervalTrees();
+	}
+	
+	CGene GetGene(const string& geneID) const
+	{
+		int geneOrdinal = mTables.FindGene(geneID);
+		
+		if (geneOrdinal < 0)
+		{
+			return CGene();
+		}
+		
+		return mTables.GetGene(geneOrdinal);
+	}
+	
+	string GetTranscriptGene(const string& transcriptID) const
+	{
+		int transcriptRow = mTables.FindTranscript(transcriptID);
+		
+		if (transcriptRow < 0)
+		{
+			return string();
+		}
+		
+		return string(mTables.GetString(mTables.geneID[mTables.transcriptGene[transcriptRow]]));
+	}
+	
+	unsigned int GetNumGenes() const
+	{
+		return mTables.geneID.size();
+	}
+	
+	string GetGeneID(uint32_t geneOrdinal) const
+	{
+		if (geneOrdinal >= GetNumGenes())
+		{
+			stringstream errorStr;
+			errorStr << "Gene ordinal " << geneOrdinal << " out of range";
+			throw std::out_of_range(errorStr.str());
+		}
+		
+		return string(mTables.GetString(mTables.geneID[geneOrdinal]));
+	}
+	
+	uint32_t GetGeneOrdinal(const string& geneID) const
+	{
+		// Ordinals are assigned in gene id order
+		int geneOrdinal = mTables.FindGene(geneID);
+		
+		if (geneOrdinal < 0)
+		{
+			stringstream errorStr;
+			errorStr << "Gene " << geneID << " not found";
+			throw std::invalid_argument(errorStr.str());
+		}
+		
+		return geneOrdinal;
+	}
+	
+	unsigned int GetNumChromosomes() const
+	{
+		return mTables.chromosomeName.size();
+	}
+	
+	string GetChromosomeName(int chromosomeID) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			stringstream errorStr;
+			errorStr << "Chromosome id " << chromosomeID << " out of range";
+			throw std::out_of_range(errorStr.str());
+		}
+		
+		return string(mTables.GetString(mTables.chromosomeName[chromosomeID]));
+	}
+	
+	int GetChromosomeID(const string& chromosome) const
+	{
+		// Ids are assigned in chromosome name order, -1 for chromosomes without genes
+		return mTables.FindChromosome(chromosome);
+	}
+	
+	void FindOverlappingGeneOrdinals(int chromosomeID, int start, int end, vector<uint32_t>& geneOrdinals) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return;
+		}
+		
+		QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				intervals.FindOverlapping(start, end, geneOrdinals);
+			});
+	}
+	
+	void FindContainedGeneOrdinals(int chromosomeID, int start, int end, vector<uint32_t>& geneOrdinals) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return;
+		}
+		
+		QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				intervals.FindContained(start, end, geneOrdinals);
+			});
+	}
+	
+	void FindNearestGeneOrdinals(int chromosomeID, int position, vector<uint32_t>& geneOrdinals) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return;
+		}
+		
+		QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				intervals.FindNearest(position, geneOrdinals);
+			});
+	}
+	
+	void FindOverlappingGeneOrdinals(const string& chromosome, int start, int end, vector<uint32_t>& geneOrdinals) const
+	{
+		FindOverlappingGeneOrdinals(GetChromosomeID(chromosome), start, end, geneOrdinals);
+	}
+	
+	void FindContainedGeneOrdinals(const string& chromosome, int start, int end, vector<uint32_t>& geneOrdinals) const
+	{
+		FindContainedGeneOrdinals(GetChromosomeID(chromosome), start, end, geneOrdinals);
+	}
+	
+	void FindNearestGeneOrdinals(const string& chromosome, int position, vector<uint32_t>& geneOrdinals) const
+	{
+		FindNearestGeneOrdinals(GetChromosomeID(chromosome), position, geneOrdinals);
+	}
+	
+	// Up to k genes nearest to position and at most maxDistance from it, as
+	// (gene ordinal, signed distance) pairs in order of absolute distance.
+	// Distances are relative to the gene strand, negative for genes upstream
+	// of position and positive for genes downstream of it, and 0 for genes
+	// overlapping it, which are only found in any direction.
+	void FindKNearestGeneOrdinals(int chromosomeID, int position, size_t k, ENearestDirection direction, int maxDistance,
+								  vector<pair<uint32_t, int> >& nearest) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return;
+		}
+		
+		size_t nearestBegin = nearest.size();
+		auto filter = [&](int, int, uint32_t geneOrdinal, int distance)
+		{
+			int strandDistance = GetStrandDistance(geneOrdinal, distance);
+			return direction == AnyNearestDirection ||
+				(direction == UpstreamNearestDirection && strandDistance < 0) ||
+				(direction == DownstreamNearestDirection && strandDistance > 0);
+		};
+		
+		QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				intervals.FindKNearest(position, k, maxDistance, filter, nearest);
+			});
+		
+		for (vector<pair<uint32_t, int> >::iterator nearestIter = nearest.begin() + nearestBegin; nearestIter != nearest.end(); nearestIter++)
+		{
+			nearestIter->second = GetStrandDistance(nearestIter->first, nearestIter->second);
+		}
+		sort(nearest.begin() + nearestBegin, nearest.end(), NearerCmp<uint32_t>);
+	}
+	
+	void FindKNearestGeneOrdinals(const string& chromosome, int position, size_t k, ENearestDirection direction, int maxDistance,
+								  vector<pair<uint32_t, int> >& nearest) const
+	{
+		FindKNearestGeneOrdinals(GetChromosomeID(chromosome), position, k, direction, maxDistance, nearest);
+	}
+	
+	void FindKNearestGenes(int chromosomeID, int position, size_t k, ENearestDirection direction, int maxDistance,
+						   vector<pair<string, int> >& nearest) const
+	{
+		vector<pair<uint32_t, int> > nearestOrdinals;
+		FindKNearestGeneOrdinals(chromosomeID, position, k, direction, maxDistance, nearestOrdinals);
+		for (vector<pair<uint32_t, int> >::const_iterator nearestIter = nearestOrdinals.begin(); nearestIter != nearestOrdinals.end(); nearestIter++)
+		{
+			nearest.push_back(make_pair(GetGeneID(nearestIter->first), nearestIter->second));
+		}
+	}
+	
+	void FindKNearestGenes(const string& chromosome, int position, size_t k, ENearestDirection direction, int maxDistance,
+						   vector<pair<string, int> >& nearest) const
+	{
+		FindKNearestGenes(GetChromosomeID(chromosome), position, k, direction, maxDistance, nearest);
+	}
+	
+	void FindOverlappingGenes(int chromosomeID, int start, int end, vector<string>& genes) const
+	{
+		vector<uint32_t> geneOrdinals;
+		FindOverlappingGeneOrdinals(chromosomeID, start, end, geneOrdinals);
+		AppendGeneIDs(geneOrdinals, genes);
+	}
+	
+	void FindContainedGenes(int chromosomeID, int start, int end, vector<string>& genes) const
+	{
+		vector<uint32_t> geneOrdinals;
+		FindContainedGeneOrdinals(chromosomeID, start, end, geneOrdinals);
+		AppendGeneIDs(geneOrdinals, genes);
+	}
+	
+	void FindNearestGenes(int chromosomeID, int position, vector<string>& genes) const
+	{
+		vector<uint32_t> geneOrdinals;
+		FindNearestGeneOrdinals(chromosomeID, position, geneOrdinals);
+		AppendGeneIDs(geneOrdinals, genes);
+	}
+	
+	void FindOverlappingGenes(const string& chromosome, int start, int end, vector<string>& genes) const
+	{
+		FindOverlappingGenes(GetChromosomeID(chromosome), start, end, genes);
+	}
+	
+	void FindContainedGenes(const string& chromosome, int start, int end, vector<string>& genes) const
+	{
+		FindContainedGenes(GetChromosomeID(chromosome), start, end, genes);
+	}
+	
+	void FindNearestGenes(const string& chromosome, int position, vector<string>& genes) const
+	{
+		FindNearestGenes(GetChromosomeID(chromosome), position, genes);
+	}
+	
+	// Number of genes overlapping or contained in a region, and whether any
+	// gene overlaps it, without collecting the genes
+	size_t CountOverlappingGenes(int chromosomeID, int start, int end) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return 0;
+		}
+		
+		return QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				return intervals.CountOverlapping(start, end);
+			});
+	}
+	
+	size_t CountContainedGenes(int chromosomeID, int start, int end) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return 0;
+		}
+		
+		return QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				return intervals.CountContained(start, end);
+			});
+	}
+	
+	bool AnyOverlappingGenes(int chromosomeID, int start, int end) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return false;
+		}
+		
+		return QueryGeneIntervals(chromosomeID, [&](const auto& intervals)
+			{
+				return intervals.AnyOverlapping(start, end);
+			});
+	}
+	
+	size_t CountOverlappingGenes(const string& chromosome, int start, int end) const
+	{
+		return CountOverlappingGenes(GetChromosomeID(chromosome), start, end);
+	}
+	
+	size_t CountContainedGenes(const string& chromosome, int start, int end) const
+	{
+		return CountContainedGenes(GetChromosomeID(chromosome), start, end);
+	}
+	
+	bool AnyOverlappingGenes(const string& chromosome, int start, int end) const
+	{
+		return AnyOverlappingGenes(GetChromosomeID(chromosome), start, end);
+	}
+	
+	// Genes overlapping position, and genes within flank of position, with
+	// the location of position relative to each as CalculateGeneLocation
+	// would give, in gene ordinal order.  Overlapping genes are found in a
+	// single lookup of the precomputed annotation segments.
+	void AnnotatePosition(int chromosomeID, int position, vector<uint32_t>& geneOrdinals, vector<EGeneLocation>& locations, int flank = 0) const
+	{
+		if (chromosomeID < 0 || chromosomeID >= (int)GetNumChromosomes())
+		{
+			return;
+		}
+		
+		size_t annotationsBegin = geneOrdinals.size();
+		mTables.AnnotatePosition(chromosomeID, position, geneOrdinals, locations);
+		
+		if (flank <= 0)
+		{
+			return;
+		}
+		
+		int flankStart = (int)max((long long)numeric_limits<int>::min(), (long long)position - flank);
+		int flankEnd = (int)min((long long)numeric_limits<int>::max(), (long long)position + flank);
+		
+		vector<uint32_t> flankingGeneOrdinals;
+		FindOverlappingGeneOrdinals(chromosomeID, flankStart, flankEnd, flankingGeneOrdinals);
+		sort(flankingGeneOrdinals.begin(), flankingGeneOrdinals.end());
+		
+		// Merge genes within flank but not overlapping position into the
+		// overlapping genes in gene ordinal order
+		vector<pair<uint32_t,EGeneLocation> > annotations;
+		for (size_t annotationIndex = annotationsBegin; annotationIndex < geneOrdinals.size(); annotationIndex++)
+		{
+			annotations.push_back(make_pair(geneOrdinals[annotationIndex], locations[annotationIndex]));
+		}
+		
+		for (vector<uint32_t>::const_iterator geneOrdinalIter = flankingGeneOrdinals.begin(); geneOrdinalIter != flankingGeneOrdinals.end(); geneOrdinalIter++)
+		{
+			if (position < mTables.geneStart[*geneOrdinalIter] || position > mTables.geneEnd[*geneOrdinalIter])
+			{
+				annotations.push_back(make_pair(*geneOrdinalIter, mTables.CalculateGeneLocation(*geneOrdinalIter, position)));
+			}
+		}
+		
+		sort(annotations.begin(), annotations.end());
+		
+		geneOrdinals.resize(annotationsBegin);
+		locations.resize(annotationsBegin);
+		for (vector<pair<uint32_t,EGeneLocation> >::const_iterator annotationIter = annotations.begin(); annotationIter != annotations.end(); annotationIter++)
+		{
+			geneOrdinals.push_back(annotationIter->first);
+			locations.push_back(annotationIter->second);
+		}
+	}
+	
+	void AnnotatePosition(const string& chromosome, int position, vector<uint32_t>& geneOrdinals, vector<EGeneLocation>& locations, int flank = 0) const
+	{
+		AnnotatePosition(GetChromosomeID(chromosome), position, geneOrdinals, locations, flank);
+	}
+	
+	string CalculateGeneLocation(const string& geneID, int position) const
+	{
+		return GetGeneLocationName(mTables.CalculateGeneLocation(mTables.FindGene(geneID), position));
+	}
+	
+	int CalculateGenomicPosition(const string& transcriptID, int position) const
+	{
+		return mTables.CalculateGenomicPosition(GetTranscriptRow(transcriptID), position);
+	}
+	
+	void CalculateGenomicRegions(const string& transcriptID, int start, int end, vector<CRegion>& regions) const
+	{
+		mTables.CalculateGenomicRegions(GetTranscriptRow(transcriptID), start, end, regions);
+	}
+	
+	// Batch queries over arrays of numQueries chromosome ids and regions or
+	// positions, on numThreads threads, 0 for all hardware threads.  The
+	// results of query i are written to geneOrdinals at [offsets[i],
+	// offsets[i + 1]), offsets having numQueries + 1 entries.  Results are
+	// in query order regardless of the number of threads.
+	void FindOverlappingGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+									 vector<uint64_t>& offsets, vector<uint32_t>& geneOrdinals, int numThreads = 1) const
+	{
+		RunBatchQueries(numQueries, numThreads, offsets, geneOrdinals, 0,
+			[&](size_t queryIndex, CBatchResults& results)
+			{
+				FindOverlappingGeneOrdinals(chromosomeIDs[queryIndex], starts[queryIndex], ends[queryIndex], results.geneOrdinals);
+			});
+	}
+	
+	void FindContainedGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+								   vector<uint64_t>& offsets, vector<uint32_t>& geneOrdinals, int numThreads = 1) const
+	{
+		RunBatchQueries(numQueries, numThreads, offsets, geneOrdinals, 0,
+			[&](size_t queryIndex, CBatchResults& results)
+			{
+				FindContainedGeneOrdinals(chromosomeIDs[queryIndex], starts[queryIndex], ends[queryIndex], results.geneOrdinals);
+			});
+	}
+	
+	void FindNearestGeneOrdinals(const int* chromosomeIDs, const int* positions, size_t numQueries,
+								 vector<uint64_t>& offsets, vector<uint32_t>& geneOrdinals, int numThreads = 1) const
+	{
+		RunBatchQueries(numQueries, numThreads, offsets, geneOrdinals, 0,
+			[&](size_t queryIndex, CBatchResults& results)
+			{
+				FindNearestGeneOrdinals(chromosomeIDs[queryIndex], positions[queryIndex], results.geneOrdinals);
+			});
+	}
+	
+	void AnnotatePositions(const int* chromosomeIDs, const int* positions, size_t numQueries, int flank,
+						   vector<uint64_t>& offsets, vector<uint32_t>& geneOrdinals, vector<EGeneLocation>& locations, int numThreads = 1) const
+	{
+		RunBatchQueries(numQueries, numThreads, offsets, geneOrdinals, &locations,
+			[&](size_t queryIndex, CBatchResults& results)
+			{
+				AnnotatePosition(chromosomeIDs[queryIndex], positions[queryIndex], results.geneOrdinals, results.locations, flank);
+			});
+	}
+	
+	// Number of genes overlapping or contained in each of numQueries regions,
+	// and whether any gene overlaps each
+	void CountOverlappingGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries, uint32_t* counts, int numThreads = 1) const
+	{
+		ParallelFor(numQueries, BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					counts[queryIndex] = CountOverlappingGenes(chromosomeIDs[queryIndex], starts[queryIndex], ends[queryIndex]);
+				}
+			});
+	}
+	
+	void CountContainedGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries, uint32_t* counts, int numThreads = 1) const
+	{
+		ParallelFor(numQueries, BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					counts[queryIndex] = CountContainedGenes(chromosomeIDs[queryIndex], starts[queryIndex], ends[queryIndex]);
+				}
+			});
+	}
+	
+	void AnyOverlappingGenes(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries, uint8_t* anyOverlapping, int numThreads = 1) const
+	{
+		ParallelFor(numQueries, BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					anyOverlapping[queryIndex] = AnyOverlappingGenes(chromosomeIDs[queryIndex], starts[queryIndex], ends[queryIndex]);
+				}
+			});
+	}
+	
+	// Location of each of numQueries positions in the gene given by ordinal
+	void CalculateGeneLocations(const uint32_t* geneOrdinals, const int* positions, size_t numQueries, EGeneLocation* locations, int numThreads = 1) const
+	{
+		ParallelFor(numQueries, BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					if (geneOrdinals[queryIndex] >= GetNumGenes())
+					{
+						stringstream errorStr;
+						errorStr << "Gene ordinal " << geneOrdinals[queryIndex] << " out of range";
+						throw std::out_of_range(errorStr.str());
+					}
+					
+					locations[queryIndex] = mTables.CalculateGeneLocation(geneOrdinals[queryIndex], positions[queryIndex]);
+				}
+			});
+	}
+	
+	// Join numQueries regions against the genes overlapping them, appending a
+	// query index and gene ordinal for each overlap.  Queries are sorted by
+	// chromosome and start, unless already sorted, and swept against the
+	// genes of each chromosome in start order in a single merge pass.  Pairs
+	// are ordered by the start of the later starting of query and gene.
+	// Queries on unknown chromosomes or ending before their start overlap
+	// no genes.
+	void JoinOverlappingGeneOrdinals(const int* chromosomeIDs, const int* starts, const int* ends, size_t numQueries,
+									 vector<uint64_t>& queryIndices, vector<uint32_t>& geneOrdinals) const
+	{
+		vector<uint64_t> queryOrder;
+		for (size_t queryIndex = 0; queryIndex < numQueries; queryIndex++)
+		{
+			if (chromosomeIDs[queryIndex] >= 0 && chromosomeIDs[queryIndex] < (int)GetNumChromosomes() && starts[queryIndex] <= ends[queryIndex])
+			{
+				queryOrder.push_back(queryIndex);
+			}
+		}
+		
+		CQueryStartLess queryStartLess(chromosomeIDs, starts);
+		if (!is_sorted(queryOrder.begin(), queryOrder.end(), queryStartLess))
+		{
+			stable_sort(queryOrder.begin(), queryOrder.end(), queryStartLess);
+		}
+		
+		vector<uint64_t>::const_iterator chromosomeQueriesBegin = queryOrder.begin();
+		while (chromosomeQueriesBegin != queryOrder.end())
+		{
+			int chromosomeID = chromosomeIDs[*chromosomeQueriesBegin];
+			
+			vector<uint64_t>::const_iterator chromosomeQueriesEnd = chromosomeQueriesBegin;
+			while (chromosomeQueriesEnd != queryOrder.end() && chromosomeIDs[*chromosomeQueriesEnd] == chromosomeID)
+			{
+				chromosomeQueriesEnd++;
+			}
+			
+			const CInterval<uint32_t>* genesBegin = mTables.chromosomeGenes.data() + mTables.chromosomeGeneOffsets[chromosomeID];
+			const CInterval<uint32_t>* genesEnd = mTables.chromosomeGenes.data() + mTables.chromosomeGeneOffsets[chromosomeID + 1];
+			
+			JoinChromosome(chromosomeQueriesBegin, chromosomeQueriesEnd, starts, ends, genesBegin, genesEnd, queryIndices, geneOrdinals);
+			
+			chromosomeQueriesBegin = chromosomeQueriesEnd;
+		}
+	}
+	
+	// Genomic position of each of numQueries positions in the transcripts
+	void CalculateGenomicPositions(const vector<string>& transcriptIDs, const int* positions, int* genomicPositions, int numThreads = 1) const
+	{
+		ParallelFor(transcriptIDs.size(), BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					genomicPositions[queryIndex] = CalculateGenomicPosition(transcriptIDs[queryIndex], positions[queryIndex]);
+				}
+			});
+	}
+	
+private:
+	// Number of queries handled as a unit by batch query threads
+	static const size_t BatchChunkSize = 1024;
+	
+	// Order of queries by chromosome and start
+	struct CQueryStartLess
+	{
+		CQueryStartLess(const int* chromosomeIDs, const int* starts) : chromosomeIDs(chromosomeIDs), starts(starts) {}
+		
+		bool operator()(uint64_t queryIndex1, uint64_t queryIndex2) const
+		{
+			return chromosomeIDs[queryIndex1] < chromosomeIDs[queryIndex2] ||
+				(chromosomeIDs[queryIndex1] == chromosomeIDs[queryIndex2] && starts[queryIndex1] < starts[queryIndex2]);
+		}
+		
+		const int* chromosomeIDs;
+		const int* starts;
+	};
+	
+	// Sweep queries and genes of a chromosome, both in start order.  Each
+	// query or gene, when reached, overlaps exactly those already reached
+	// of the other kind that have not ended before its start.  Those that
+	// have ended are dropped, so each is dropped at most once.
+	static void JoinChromosome(vector<uint64_t>::const_iterator queriesBegin, vector<uint64_t>::const_iterator queriesEnd,
+							   const int* starts, const int* ends, const CInterval<uint32_t>* genesBegin, const CInterval<uint32_t>* genesEnd,
+							   vector<uint64_t>& queryIndices, vector<uint32_t>& geneOrdinals)
+	{
+		vector<uint64_t> activeQueries;
+		vector<const CInterval<uint32_t>*> activeGenes;
+		
+		vector<uint64_t>::const_iterator queryIter = queriesBegin;
+		const CInterval<uint32_t>* geneIter = genesBegin;
+		
+		// Genes after the last query overlap only queries still active
+		while (queryIter != queriesEnd || (geneIter != genesEnd && !activeQueries.empty()))
+		{
+			if (geneIter != genesEnd && (queryIter == queriesEnd || geneIter->start <= starts[*queryIter]))
+			{
+				size_t numActive = 0;
+				for (size_t activeIndex = 0; activeIndex < activeQueries.size(); activeIndex++)
+				{
+					if (ends[activeQueries[activeIndex]] >= geneIter->start)
+					{
+						activeQueries[numActive++] = activeQueries[activeIndex];
+						queryIndices.push_back(activeQueries[activeIndex]);
+						geneOrdinals.push_back(geneIter->value);
+					}
+				}
+				activeQueries.resize(numActive);
+				
+				activeGenes.push_back(geneIter);
+				geneIter++;
+			}
+			else
+			{
+				size_t numActive = 0;
+				for (size_t activeIndex = 0; activeIndex < activeGenes.size(); activeIndex++)
+				{
+					if (activeGenes[activeIndex]->stop >= starts[*queryIter])
+					{
+						activeGenes[numActive++] = activeGenes[activeIndex];
+						queryIndices.push_back(*queryIter);
+						geneOrdinals.push_back(activeGenes[activeIndex]->value);
+					}
+				}
+				activeGenes.resize(numActive);
+				
+				activeQueries.push_back(*queryIter);
+				queryIter++;
+			}
+		}
+	}
+	
+	// Results of a chunk of batch queries
+	struct CBatchResults
+	{
+		vector<uint32_t> geneOrdinals;
+		vector<EGeneLocation> locations;
+	};
+	
+	// Run query(queryIndex, results) for each query in parallel chunks, each
+	// chunk appending to its own results, then concatenate the results of
+	// all chunks in query order
+	template <class TQuery>
+	void RunBatchQueries(size_t numQueries, int numThreads, vector<uint64_t>& offsets, vector<uint32_t>& geneOrdinals,
+						 vector<EGeneLocation>* locations, TQuery query) const
+	{
+		size_t offsetsBegin = offsets.size();
+		offsets.resize(offsetsBegin + numQueries + 1);
+		
+		vector<CBatchResults> chunkResults((numQueries + BatchChunkSize - 1) / BatchChunkSize);
+		
+		// Offsets are first relative to the results of each chunk
+		ParallelFor(numQueries, BatchChunkSize, numThreads,
+			[&](size_t queriesBegin, size_t queriesEnd)
+			{
+				CBatchResults& results = chunkResults[queriesBegin / BatchChunkSize];
+				for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+				{
+					query(queryIndex, results);
+					offsets[offsetsBegin + queryIndex + 1] = results.geneOrdinals.size();
+				}
+			});
+		
+		offsets[offsetsBegin] = geneOrdinals.size();
+		for (size_t chunkIndex = 0; chunkIndex < chunkResults.size(); chunkIndex++)
+		{
+			uint64_t chunkOffset = geneOrdinals.size();
+			
+			size_t queriesBegin = chunkIndex * BatchChunkSize;
+			size_t queriesEnd = min(numQueries, queriesBegin + BatchChunkSize);
+			for (size_t queryIndex = queriesBegin; queryIndex < queriesEnd; queryIndex++)
+			{
+				offsets[offsetsBegin + queryIndex + 1] += chunkOffset;
+			}
+			
+			const CBatchResults& results = chunkResults[chunkIndex];
+			geneOrdinals.insert(geneOrdinals.end(), results.geneOrdinals.begin(), results.geneOrdinals.end());
+			if (locations != 0)
+			{
+				locations->insert(locations->end(), results.locations.begin(), results.locations.end());
+			}
+		}
+	}
+	
+	// State carried across the records of a single gtf load
+	struct CGTFLoadState
+	{
+		CGTFLoadState() : gene(0), geneRegion(0), hasTranscript(false), transcriptExons(0), transcriptCDSs(0) {}
+		
+		// Records keyed by gene and transcript id, from which the model's
+		// tables are built once the load is complete
+		map<string,CGene> genes;
+		map<string,CRegion> geneRegions;
+		map<string,set<string> > geneTranscripts;
+		map<string,string> transcriptGene;
+		map<string,vector<CRegion> > exons;
+		map<string,vector<CRegion> > cdss;
+		map<string,CRegion> startCodon;
+		map<string,CRegion> stopCodon;
+		
+		// Consecutive records usually share gene and transcript, cache
+		// the entries of the most recent ones
+		CGene* gene;
+		CRegion* geneRegion;
+		bool hasTranscript;
+		string transcriptID;
+		vector<CRegion>* transcriptExons;
+		vector<CRegion>* transcriptCDSs;
+	};
+	
+	void AddGTFLine(string_view line, int lineNumber, const string& gtfFilename, CGTFLoadState& state)
+	{
+		CGTFRecord record;
+		if (ReadGTFLine(line, lineNumber, gtfFilename, record))
+		{
+			AddGTFRecord(record, state);
+		}
+	}
+	
+	void AddGTFRecord(const CGTFRecord& record, CGTFLoadState& state)
+	{
+		if (state.gene == 0 || state.gene->id != record.geneID)
+		{
+			string geneID(record.geneID);
+			
+			state.gene = &state.genes[geneID];
+			state.gene->id = geneID;
+			
+			pair<map<string,CRegion>::iterator,bool> geneRegionInsert = state.geneRegions.insert(make_pair(geneID, CRegion(record.start, record.end)));
+			state.geneRegion = &geneRegionInsert.first->second;
+			
+			state.hasTranscript = false;
+		}
+		
+		state.geneRegion->start = min(state.geneRegion->start, record.start);
+		state.geneRegion->end = max(state.geneRegion->end, record.end);
+		
+		CGene& gene = *state.gene;
+		gene.name = record.geneName;
+		gene.source = record.source;
+		gene.chromosome = record.chromosome;
+		gene.strand = record.strand;
+		
+		if (!state.hasTranscript || state.transcriptID != record.transcriptID)
+		{
+			state.hasTranscript = true;
+			state.transcriptID = record.transcriptID;
+			state.transcriptExons = 0;
+			state.transcriptCDSs = 0;
+			
+			state.geneTranscripts[gene.id].insert(state.transcriptID);
+			state.transcriptGene[state.transcriptID] = gene.id;
+		}
+		
+		if (record.featureType == "exon")
+		{
+			if (state.transcriptExons == 0)
+			{
+				state.transcriptExons = &state.exons[state.transcriptID];
+			}
+			state.transcriptExons->push_back(CRegion(record.start, record.end));
+		}
+		else if (record.featureType == "CDS")
+		{
+			if (state.transcriptCDSs == 0)
+			{
+				state.transcriptCDSs = &state.cdss[state.transcriptID];
+			}
+			state.transcriptCDSs->push_back(CRegion(record.start, record.end));
+		}
+		else if (record.featureType == "start_codon")
+		{
+			state.startCodon[state.transcriptID] = CRegion(record.start, record.end);
 		}
-		
-		// Parse file contents
-		string line;
-		int lineNumber = 0;
-		while (getline(gtfFile, line))
+		else if (record.featureType == "stop_codon")
 		{
-			lineNumber++;
-			
-			if (line.substr(0, 2) == "#!")
+			state.stopCodon[state.transcriptID] = CRegion(record.start, record.end);
+		}
+	}
+	
+	// Merge chunk tables into the model.  Entries for the same gene or
+	// transcript are grouped by a stable sort, keeping them in chunk order so
+	// that the last chunk wins as the last record would, and are inserted in
+	// key order with a position hint.
+	void MergeGTFChunks(vector<CGTFChunk>& chunks, CGTFLoadState& state)
+	{
+		vector<CGTFGeneEntry*> genes;
+		vector<CGTFTranscriptEntry*> transcripts;
+		for (vector<CGTFChunk>::iterator chunkIter = chunks.begin(); chunkIter != chunks.end(); chunkIter++)
+		{
+			for (vector<CGTFGeneEntry>::iterator geneIter = chunkIter->genes.begin(); geneIter != chunkIter->genes.end(); geneIter++)
 			{
-				continue;
+				genes.push_back(&(*geneIter));
 			}
-			
-			if (line.length() == 0)
+			for (vector<CGTFTranscriptEntry>::iterator transcriptIter = chunkIter->transcripts.begin(); transcriptIter != chunkIter->transcripts.end(); transcriptIter++)
 			{
-				stringstream errorStr;
-				errorStr << "Empty gtf line " << lineNumber << " of " << gtfFilename;
-				throw std::invalid_argument(errorStr.str());
+				transcripts.push_back(&(*transcriptIter));
 			}
-			
-			vector<string> gtfFields;
-
-			splitbytoken(gtfFields, line, '\t');
-
-			if (gtfFields.size() < 9)
+		}
+		
+		stable_sort(genes.begin(), genes.end(), EntryIDLess<CGTFGeneEntry>);
+		stable_sort(transcripts.begin(), transcripts.end(), EntryIDLess<CGTFTranscriptEntry>);
+		
+		map<string,CGene>::iterator geneHint = state.genes.end();
+		map<string,CRegion>::iterator geneRegionHint = state.geneRegions.end();
+		for (size_t groupStart = 0, groupEnd = 0; groupStart < genes.size(); groupStart = groupEnd)
+		{
+			CRegion region = genes[groupStart]->region;
+			for (groupEnd = groupStart + 1; groupEnd < genes.size() && genes[groupEnd]->id == genes[groupStart]->id; groupEnd++)
 			{
-				stringstream errorStr;
-				errorStr << "Error: Format error for gtf line " << lineNumber << " of " << gtfFilename;
-				throw std::invalid_argument(errorStr.str());
+				region.start = min(region.start, genes[groupEnd]->region.start);
+				region.end = max(region.end, genes[groupEnd]->region.end);
 			}
 			
-			const string& chromosome = gtfFields[0];
-			const string& source = gtfFields[1];
-			const string& featureType = gtfFields[2];
-			int start = lexical_cast<int>(gtfFields[3]);
-			int end = lexical_cast<int>(gtfFields[4]);
-			const string& strand = gtfFields[6];
+			const CGTFGeneEntry& last = *genes[groupEnd - 1];
+			
+			geneHint = state.genes.emplace_hint(geneHint, string(last.id), CGene());
+			CGene& gene = geneHint->second;
+			gene.id = last.id;
+			gene.name = last.name;
+			gene.source = last.source;
+			gene.chromosome = last.chromosome;
+			gene.strand = last.strand;
+			++geneHint;
 			
-			vector<string> featureFields;
-			splitbytoken(featureFields, gtfFields[8], ';');
+			geneRegionHint = state.geneRegions.emplace_hint(geneRegionHint, string(last.id), region);
+			++geneRegionHint;
+		}
+		
+		vector<pair<string_view,string_view> > geneTranscripts;
+		
+		map<string,string>::iterator transcriptGeneHint = state.transcriptGene.end();
+		map<string,vector<CRegion> >::iterator exonsHint = state.exons.end();
+		map<string,vector<CRegion> >::iterator cdssHint = state.cdss.end();
+		map<string,CRegion>::iterator startCodonHint = state.startCodon.end();
+		map<string,CRegion>::iterator stopCodonHint = state.stopCodon.end();
+		for (size_t groupStart = 0, groupEnd = 0; groupStart < transcripts.size(); groupStart = groupEnd)
+		{
+			string transcriptID(transcripts[groupStart]->id);
 			
-			string geneID;
-			string transcriptID;
-			string geneName;
-			int exonNumber = -1;
-			for (vector<string>::iterator featureIter = featureFields.begin(); featureIter != featureFields.end(); featureIter++)
+			size_t numExons = 0;
+			size_t numCDSs = 0;
+			const CGTFTranscriptEntry* startCodon = 0;
+			const CGTFTranscriptEntry* stopCodon = 0;
+			for (groupEnd = groupStart; groupEnd < transcripts.size() && transcripts[groupEnd]->id == transcripts[groupStart]->id; groupEnd++)
 			{
-				string feature = *featureIter;
-
-				feature = trim(feature);
-
-				if (feature.empty())
+				const CGTFTranscriptEntry& transcript = *transcripts[groupEnd];
+				
+				for (vector<string_view>::const_iterator geneIDIter = transcript.geneIDs.begin(); geneIDIter != transcript.geneIDs.end(); geneIDIter++)
 				{
-					continue;
+					geneTranscripts.push_back(make_pair(*geneIDIter, transcript.id));
 				}
 				
-				int firstSpace = feature.find_first_of(' ');
-				
-				string key = feature.substr(0, firstSpace);
-				string value = feature.substr(firstSpace + 2, feature.size() - firstSpace - 3);
+				numExons += transcript.exons.size();
+				numCDSs += transcript.cdss.size();
 				
-				if (key == "gene_id")
-				{
-					geneID = value;
-				}
-				else if (key == "transcript_id")
+				if (transcript.hasStartCodon)
 				{
-					transcriptID = value;
+					startCodon = &transcript;
 				}
-				else if (key == "gene_name")
+				if (transcript.hasStopCodon)
 				{
-					geneName = value;
+					stopCodon = &transcript;
 				}
-				else if (key == "exon_number")
-				{
-					exonNumber = lexical_cast<int>(value);
-				}
-				
-				assert(geneID.empty());
-				assert(transcriptID.empty());
-				assert(geneName.empty());
-				assert(exonNumber != -1);
 			}
 			
-			mGenes[geneID].id = geneID;
-			mGenes[geneID].name = geneName;
-			mGenes[geneID].source = source;
-			mGenes[geneID].chromosome = chromosome;
-			mGenes[geneID].strand = strand;
-			geneRegionStart[geneID].push_back(start);
-			geneRegionEnd[geneID].push_back(end);
-			
-			mGeneTranscripts[geneID].insert(transcriptID);
-			mTranscriptGene[transcriptID] = geneID;
+			transcriptGeneHint = state.transcriptGene.emplace_hint(transcriptGeneHint, transcriptID, string());
+			transcriptGeneHint->second = transcripts[groupEnd - 1]->geneID;
+			++transcriptGeneHint;
 			
-			if (featureType == "exon")
+			if (numExons > 0)
 			{
-				mExons[transcriptID].push_back(CRegion(start, end));
+				exonsHint = state.exons.emplace_hint(exonsHint, transcriptID, vector<CRegion>());
+				for (size_t transcriptIndex = groupStart; transcriptIndex < groupEnd; transcriptIndex++)
+				{
+					exonsHint->second.insert(exonsHint->second.end(), transcripts[transcriptIndex]->exons.begin(), transcripts[transcriptIndex]->exons.end());
+				}
+				++exonsHint;
 			}
-			else if (featureType == "CDS")
+			
+			if (numCDSs > 0)
 			{
-				mCDSs[transcriptID].push_back(CRegion(start, end));
+				cdssHint = state.cdss.emplace_hint(cdssHint, transcriptID, vector<CRegion>());
+				for (size_t transcriptIndex = groupStart; transcriptIndex < groupEnd; transcriptIndex++)
+				{
+					cdssHint->second.insert(cdssHint->second.end(), transcripts[transcriptIndex]->cdss.begin(), transcripts[transcriptIndex]->cdss.end());
+				}
+				++cdssHint;
 			}
-			else if (featureType == "start_codon")
+			
+			if (startCodon)
 			{
-				mStartCodon[transcriptID] = CRegion(start, end);
+				startCodonHint = state.startCodon.emplace_hint(startCodonHint, transcriptID, CRegion());
+				startCodonHint->second = startCodon->startCodon;
+				++startCodonHint;
 			}
-			else if (featureType == "stop_codon")
+			
+			if (stopCodon)
 			{
-				mStopCodon[transcriptID] = CRegion(start, end);
+				stopCodonHint = state.stopCodon.emplace_hint(stopCodonHint, transcriptID, CRegion());
+				stopCodonHint->second = stopCodon->stopCodon;
+				++stopCodonHint;
 			}
 		}
 		
-		map<string,vector<CInterval<string> > > geneIntervals;
+		sort(geneTranscripts.begin(), geneTranscripts.end());
 		
-		for (map<string,CGene>::const_iterator geneIter = mGenes.begin(); geneIter != mGenes.end(); geneIter++)
+		map<string,set<string> >::iterator geneTranscriptsHint = state.geneTranscripts.end();
+		for (size_t pairIndex = 0; pairIndex < geneTranscripts.size(); pairIndex++)
 		{
-			const string geneID = geneIter->first;
-			
-			int geneStart = *min_element(geneRegionStart[geneID].begin(), geneRegionStart[geneID].end());
-			int geneEnd = *max_element(geneRegionEnd[geneID].begin(), geneRegionEnd[geneID].end());
-			
-			mGenes[geneID].start = geneStart;
-			mGenes[geneID].end = geneEnd;
+			if (pairIndex == 0 || geneTranscripts[pairIndex].first != geneTranscripts[pairIndex - 1].first)
+			{
+				if (pairIndex != 0)
+				{
+					++geneTranscriptsHint;
+				}
+				geneTranscriptsHint = state.geneTranscripts.emplace_hint(geneTranscriptsHint, string(geneTranscripts[pairIndex].first), set<string>());
+			}
 			
-			geneIntervals[mGenes[geneID].chromosome].push_back(CInterval<string>(geneStart, geneEnd, geneID));
+			geneTranscriptsHint->second.emplace_hint(geneTranscriptsHint->second.end(), geneTranscripts[pairIndex].second);
 		}
-		
-		mGeneIntervalTrees.clear();
-		for (map<string,vector<CInterval<string> > >::iterator chromosomeIter = geneIntervals.begin(); chromosomeIter != geneIntervals.end(); chromosomeIter++)
+	}
+	
+	// Build the model's tables and interval trees from the loaded records,
+	// replacing the current model
+	void FinishGTFLoad(CGTFLoadState& state)
+	{
+		for (map<string,CRegion>::const_iterator geneRegionIter = state.geneRegions.begin(); geneRegionIter != state.geneRegions.end(); geneRegionIter++)
 		{
-			mGeneIntervalTrees[chromosomeIter->first] = CIntervalTree<string>(chromosomeIter->second);
+			state.genes[geneRegionIter->first].start = geneRegionIter->second.start;
+			state.genes[geneRegionIter->first].end = geneRegionIter->second.end;
 		}
 		
-		for (map<string,vector<CRegion> >::iterator exonsIter = mExons.begin(); exonsIter != mExons.end(); exonsIter++)
-		{
-			sort(exonsIter->second.begin(), exonsIter->second.end());
-			
-			int length = 0;
-			for (vector<CRegion>::const_iterator exonIter = exonsIter->second.begin(); exonIter != exonsIter->second.end(); exonIter++)
-			{
-				length += exonIter->end - exonIter->start + 1;
-			}
-			mTranscriptLength[exonsIter->first] = length;
-		}
+		mImageFile.reset();
+		mOwnedTables = CGeneModelTables<CColumn>();
+		BuildTables(state, mOwnedTables);
+		UpdateTables();
 		
-		for (map<string,vector<CRegion> >::iterator cdssIter = mCDSs.begin(); cdssIter != mCDSs.end(); cdssIter++)
-		{
-			sort(cdssIter->second.begin(), cdssIter->second.end());
-		}
+		BuildGeneIntervalTrees();
 	}
 	
-	CGene GetGene(const string& geneID)
+	// Transcript records gathered from the load state's transcript maps
+	struct CTranscriptRecords
 	{
-		return mGenes[geneID];
-	}
+		CTranscriptRecords() : id(0), gene(0), exons(0), cdss(0), startCodon(0), stopCodon(0) {}
+		
+		const string* id;
+		const string* gene;
+		const vector<CRegion>* exons;
+		const vector<CRegion>* cdss;
+		const CRegion* startCodon;
+		const CRegion* stopCodon;
+	};
 	
-	string GetTranscriptGene(const string& transcriptID)
+	static bool TranscriptRecordsIDLess(const CTranscriptRecords& records, const string& id)
 	{
-		return mTranscriptGene[transcriptID];
+		return *records.id < id;
 	}
 	
-	void FindOverlappingGenes(const string& chromosome, int start, int end, vector<string>& genes)
+	// Entry of map for key, advancing iter through map in key order
+	template <class TValue>
+	static const TValue* FindNext(const map<string,TValue>& values, typename map<string,TValue>::const_iterator& valueIter, const string& key)
 	{
-		if (mGeneIntervalTrees.find(chromosome) != mGeneIntervalTrees.end())
+		while (valueIter != values.end() && valueIter->first < key)
 		{
-			mGeneIntervalTrees[chromosome].FindOverlapping(start, end, genes);
+			valueIter++;
 		}
-	}
-	
-	void FindContainedGenes(const string& chromosome, int start, int end, vector<string>& genes)
-	{
-		if (mGeneIntervalTrees.find(chromosome) != mGeneIntervalTrees.end())
+		
+		if (valueIter == values.end() || valueIter->first != key)
 		{
-			mGeneIntervalTrees[chromosome].FindContained(start, end, genes);
+			return 0;
 		}
+		
+		return &valueIter->second;
 	}
 	
-	void FindNearestGenes(const string& chromosome, int position, vector<string>& genes)
+	// Build columnar tables from loaded records, with genes and chromosomes
+	// in id and name order, and a flat interval tree of gene intervals per
+	// chromosome
+	static void BuildTables(const CGTFLoadState& state, CGeneModelTables<CColumn>& tables)
 	{
-		if (mGeneIntervalTrees.find(chromosome) != mGeneIntervalTrees.end())
+		// Gather the records of each transcript in a single pass over the
+		// transcript maps, all of which are in transcript id order
+		vector<CTranscriptRecords> transcripts;
+		transcripts.reserve(state.transcriptGene.size());
+		
+		map<string,vector<CRegion> >::const_iterator exonsIter = state.exons.begin();
+		map<string,vector<CRegion> >::const_iterator cdssIter = state.cdss.begin();
+		map<string,CRegion>::const_iterator startCodonIter = state.startCodon.begin();
+		map<string,CRegion>::const_iterator stopCodonIter = state.stopCodon.begin();
+		for (map<string,string>::const_iterator transcriptIter = state.transcriptGene.begin(); transcriptIter != state.transcriptGene.end(); transcriptIter++)
 		{
-			mGeneIntervalTrees[chromosome].FindNearest(position, genes);
+			const string& transcriptID = transcriptIter->first;
+			
+			CTranscriptRecords records;
+			records.id = &transcriptID;
+			records.gene = &transcriptIter->second;
+			records.exons = FindNext(state.exons, exonsIter, transcriptID);
+			records.cdss = FindNext(state.cdss, cdssIter, transcriptID);
+			records.startCodon = FindNext(state.startCodon, startCodonIter, transcriptID);
+			records.stopCodon = FindNext(state.stopCodon, stopCodonIter, transcriptID);
+			transcripts.push_back(records);
+		}
+		
+		// Only strings shared by many genes are pooled, ids are unique
+		unordered_map<string,uint32_t> sharedStringRefs;
+		tables.stringOffsets.push_back(0);
+		
+		set<string> chromosomes;
+		for (map<string,CGene>::const_iterator geneIter = state.genes.begin(); geneIter != state.genes.end(); geneIter++)
+		{
+			chromosomes.insert(geneIter->second.chromosome);
+		}
+		
+		vector<string> chromosomeNames(chromosomes.begin(), chromosomes.end());
+		for (vector<string>::const_iterator chromosomeIter = chromosomeNames.begin(); chromosomeIter != chromosomeNames.end(); chromosomeIter++)
+		{
+			tables.chromosomeName.push_back(AddTableString(*chromosomeIter, tables));
+		}
+		
+		vector<vector<CInterval<uint32_t> > > chromosomeIntervals(chromosomeNames.size());
+		vector<pair<string_view,uint32_t> > transcriptIndex;
+		
+		tables.geneTranscriptOffsets.push_back(0);
+		tables.transcriptExonOffsets.push_back(0);
+		tables.transcriptCDSOffsets.push_back(0);
+		tables.geneSegmentOffsets.push_back(0);
+		
+		uint32_t geneOrdinal = 0;
+		for (map<string,CGene>::const_iterator geneIter = state.genes.begin(); geneIter != state.genes.end(); geneIter++, geneOrdinal++)
+		{
+			const CGene& gene = geneIter->second;
+			int chromosomeID = lower_bound(chromosomeNames.begin(), chromosomeNames.end(), gene.chromosome) - chromosomeNames.begin();
+			
+			tables.geneID.push_back(AddTableString(gene.id, tables));
+			tables.geneName.push_back(AddTableString(gene.name, tables));
+			tables.geneSource.push_back(AddSharedTableString(gene.source, tables, sharedStringRefs));
+			tables.geneStrand.push_back(AddSharedTableString(gene.strand, tables, sharedStringRefs));
+			tables.geneChromosome.push_back(chromosomeID);
+			tables.geneStart.push_back(gene.start);
+			tables.geneEnd.push_back(gene.end);
+			
+			chromosomeIntervals[chromosomeID].push_back(CInterval<uint32_t>(gene.start, gene.end, geneOrdinal));
+			
+			map<string,set<string> >::const_iterator geneTranscriptsIter = state.geneTranscripts.find(gene.id);
+			if (geneTranscriptsIter != state.geneTranscripts.end())
+			{
+				for (set<string>::const_iterator transcriptIter = geneTranscriptsIter->second.begin(); transcriptIter != geneTranscriptsIter->second.end(); transcriptIter++)
+				{
+					const CTranscriptRecords& records = *lower_bound(transcripts.begin(), transcripts.end(), *transcriptIter, TranscriptRecordsIDLess);
+					uint32_t transcriptRow = tables.transcriptID.size();
+					
+					tables.transcriptID.push_back(AddTableString(*records.id, tables));
+					tables.transcriptGene.push_back(geneOrdinal);
+					
+					unsigned char flags = 0;
+					CRegion startCodon;
+					CRegion stopCodon;
+					
+					if (records.startCodon)
+					{
+						flags |= CGeneModelTables<CColumn>::HasStartCodon;
+						startCodon = *records.startCodon;
+					}
+					
+					if (records.stopCodon)
+					{
+						flags |= CGeneModelTables<CColumn>::HasStopCodon;
+						stopCodon = *records.stopCodon;
+					}
+					
+					tables.transcriptFlags.push_back(flags);
+					tables.transcriptStartCodon.push_back(startCodon);
+					tables.transcriptStopCodon.push_back(stopCodon);
+					
+					int length = 0;
+					if (records.exons)
+					{
+						size_t exonsBegin = tables.exons.size();
+						tables.exons.insert(tables.exons.end(), records.exons->begin(), records.exons->end());
+						sort(tables.exons.begin() + exonsBegin, tables.exons.end());
+						
+						for (vector<CRegion>::const_iterator exonIter = records.exons->begin(); exonIter != records.exons->end(); exonIter++)
+						{
+							length += exonIter->end - exonIter->start + 1;
+						}
+					}
+					tables.transcriptExonOffsets.push_back(tables.exons.size());
+					tables.transcriptLength.push_back(length);
+					
+					if (records.cdss)
+					{
+						size_t cdssBegin = tables.cdss.size();
+						tables.cdss.insert(tables.cdss.end(), records.cdss->begin(), records.cdss->end());
+						sort(tables.cdss.begin() + cdssBegin, tables.cdss.end());
+					}
+					tables.transcriptCDSOffsets.push_back(tables.cdss.size());
+					
+					// Transcripts are found by id in the row of the gene they belong to
+					if (*records.gene == gene.id)
+					{
+						transcriptIndex.push_back(make_pair(string_view(*records.id), transcriptRow));
+					}
+				}
+			}
+			
+			tables.geneTranscriptOffsets.push_back(tables.transcriptID.size());
+			
+			AddGeneSegments(geneOrdinal, gene.strand == "+", tables);
 		}
-	}
-	
-	string CalculateGeneLocation(const string& geneID, int position)
-	{
-		const CGene& gene = mGenes[geneID];
 		
-		if ((position < gene.start && gene.strand == "+") || (position > gene.end && gene.strand == "-"))
+		sort(transcriptIndex.begin(), transcriptIndex.end());
+		for (vector<pair<string_view,uint32_t> >::const_iterator transcriptIter = transcriptIndex.begin(); transcriptIter != transcriptIndex.end(); transcriptIter++)
 		{
-			return "upstream";
+			tables.transcriptIndexID.push_back(tables.transcriptID[transcriptIter->second]);
+			tables.transcriptIndexRow.push_back(transcriptIter->second);
+		}
+		
+		tables.chromosomeAnnotationOffsets.push_back(0);
+		tables.annotationGeneOffsets.push_back(0);
+		tables.chromosomeGeneOffsets.push_back(0);
+		tables.chromosomeNodeOffsets.push_back(0);
+		tables.chromosomeIntervalOffsets.push_back(0);
+		for (vector<vector<CInterval<uint32_t> > >::iterator intervalsIter = chromosomeIntervals.begin(); intervalsIter != chromosomeIntervals.end(); intervalsIter++)
+		{
+			AddChromosomeAnnotations(*intervalsIter, tables);
+			tables.chromosomeAnnotationOffsets.push_back(tables.annotationStart.size());
+			
+			stable_sort(intervalsIter->begin(), intervalsIter->end(), StartCmp<uint32_t>);
+			tables.chromosomeGenes.insert(tables.chromosomeGenes.end(), intervalsIter->begin(), intervalsIter->end());
+			tables.chromosomeGeneOffsets.push_back(tables.chromosomeGenes.size());
+			
+			CFlatIntervalTree<uint32_t> tree(*intervalsIter);
+			
+			tables.treeNodes.insert(tables.treeNodes.end(), tree.GetNodes().begin(), tree.GetNodes().end());
+			tables.treeIntervals.insert(tables.treeIntervals.end(), tree.GetIntervals().begin(), tree.GetIntervals().end());
+			
+			tables.chromosomeNodeOffsets.push_back(tables.treeNodes.size());
+			tables.chromosomeIntervalOffsets.push_back(tables.treeIntervals.size());
 		}
+	}
+	
+	// Start or end of an exon or CDS of one of a gene's transcripts, or a
+	// codon boundary at which the transcript's location may change
+	struct CSegmentEvent
+	{
+		int position;
+		uint32_t transcriptIndex;
+		int exonDelta;
+		int cdsDelta;
 		
-		if ((position > gene.end && gene.strand == "+") || (position < gene.start && gene.strand == "-"))
+		bool operator<(const CSegmentEvent& other) const
 		{
-			return "downstream";
+			return position < other.position;
 		}
+	};
+	
+	// Location of position given which of a gene's transcripts have an exon
+	// and a CDS covering position, applying the location rules transcript by
+	// transcript in transcript id order
+	static EGeneLocation ClassifyPosition(int position, bool plusStrand, uint32_t transcriptsBegin, const vector<int>& exonCounts,
+										  const vector<int>& cdsCounts, const CGeneModelTables<CColumn>& tables)
+	{
+		const unsigned char hasCodons = CGeneModelTables<CColumn>::HasStartCodon | CGeneModelTables<CColumn>::HasStopCodon;
 		
 		bool exon = false;
 		bool cds = false;
 		bool utr5p = false;
 		bool utr3p = false;
-		for (set<string>::const_iterator transcriptIter = mGeneTranscripts[geneID].begin(); transcriptIter != mGeneTranscripts[geneID].end(); transcriptIter++)
+		for (uint32_t transcriptIndex = 0; transcriptIndex < exonCounts.size(); transcriptIndex++)
 		{
-			const string& transcriptID = *transcriptIter;
+			uint32_t transcriptRow = transcriptsBegin + transcriptIndex;
 			
-			for (vector<CRegion>::const_iterator exonIter = mExons[transcriptID].begin(); exonIter != mExons[transcriptID].end(); exonIter++)
+			if (exonCounts[transcriptIndex] > 0)
 			{
-				if (position >= exonIter->start && position <= exonIter->end)
-				{
-					exon = true;
-				}
+				exon = true;
 			}
 			
-			for (vector<CRegion>::const_iterator cdsIter = mCDSs[transcriptID].begin(); cdsIter != mCDSs[transcriptID].end(); cdsIter++)
+			if (cdsCounts[transcriptIndex] > 0)
 			{
-				if (position >= cdsIter->start && position <= cdsIter->end)
-				{
-					cds = true;
-				}
+				cds = true;
 			}
 			
-			if (exon && !cds && mStartCodon.find(transcriptID) != mStartCodon.end() && mStopCodon.find(transcriptID) != mStopCodon.end())
+			if (exon && !cds && (tables.transcriptFlags[transcriptRow] & hasCodons) == hasCodons)
 			{
-				if (gene.strand == "+")
+				const CRegion& startCodon = tables.transcriptStartCodon[transcriptRow];
+				const CRegion& stopCodon = tables.transcriptStopCodon[transcriptRow];
+				
+				if (plusStrand)
 				{
-					if (position < mStartCodon[transcriptID].start)
+					if (position < startCodon.start)
 					{
 						utr5p = true;
 					}
-					else if (position > mStopCodon[transcriptID].end)
+					else if (position > stopCodon.end)
 					{
 						utr3p = true;
 					}
 				}
 				else
 				{
-					if (position > mStartCodon[transcriptID].end)
+					if (position > startCodon.end)
 					{
 						utr5p = true;
 					}
-					else if (position < mStopCodon[transcriptID].start)
+					else if (position < stopCodon.start)
 					{
 						utr3p = true;
 					}
@@ -384,114 +2609,334 @@ public:
 		
 		if (cds)
 		{
-			return "coding";
+			return CodingLocation;
 		}
 		else if (utr5p)
 		{
-			return "utr5p";
+			return UTR5pLocation;
 		}
 		else if (utr3p)
 		{
-			return "utr3p";
+			return UTR3pLocation;
 		}
 		else if (exon)
 		{
-			return "utr";
+			return UTRLocation;
 		}
 		else
 		{
-			return "intron";
+			return IntronLocation;
+		}
+	}
+	
+	// Precompute the location segments of a gene whose transcript rows have
+	// been added.  Location can only change where an exon or CDS starts or
+	// ends or at a codon boundary, so positions are swept through these
+	// breakpoints keeping per transcript exon and CDS counts, and the
+	// location is evaluated once per breakpoint.
+	static void AddGeneSegments(uint32_t geneOrdinal, bool plusStrand, CGeneModelTables<CColumn>& tables)
+	{
+		const unsigned char hasCodons = CGeneModelTables<CColumn>::HasStartCodon | CGeneModelTables<CColumn>::HasStopCodon;
+		
+		uint32_t transcriptsBegin = tables.geneTranscriptOffsets[geneOrdinal];
+		uint32_t transcriptsEnd = tables.geneTranscriptOffsets[geneOrdinal + 1];
+		
+		vector<CSegmentEvent> events;
+		for (uint32_t transcriptRow = transcriptsBegin; transcriptRow != transcriptsEnd; transcriptRow++)
+		{
+			uint32_t transcriptIndex = transcriptRow - transcriptsBegin;
+			
+			for (uint32_t exonIndex = tables.transcriptExonOffsets[transcriptRow]; exonIndex != tables.transcriptExonOffsets[transcriptRow + 1]; exonIndex++)
+			{
+				const CRegion& exon = tables.exons[exonIndex];
+				events.push_back(CSegmentEvent{exon.start, transcriptIndex, 1, 0});
+				events.push_back(CSegmentEvent{exon.end + 1, transcriptIndex, -1, 0});
+			}
+			
+			for (uint32_t cdsIndex = tables.transcriptCDSOffsets[transcriptRow]; cdsIndex != tables.transcriptCDSOffsets[transcriptRow + 1]; cdsIndex++)
+			{
+				const CRegion& cds = tables.cdss[cdsIndex];
+				events.push_back(CSegmentEvent{cds.start, transcriptIndex, 0, 1});
+				events.push_back(CSegmentEvent{cds.end + 1, transcriptIndex, 0, -1});
+			}
+			
+			if ((tables.transcriptFlags[transcriptRow] & hasCodons) == hasCodons)
+			{
+				const CRegion& startCodon = tables.transcriptStartCodon[transcriptRow];
+				const CRegion& stopCodon = tables.transcriptStopCodon[transcriptRow];
+				events.push_back(CSegmentEvent{startCodon.start, transcriptIndex, 0, 0});
+				events.push_back(CSegmentEvent{startCodon.end + 1, transcriptIndex, 0, 0});
+				events.push_back(CSegmentEvent{stopCodon.start, transcriptIndex, 0, 0});
+				events.push_back(CSegmentEvent{stopCodon.end + 1, transcriptIndex, 0, 0});
+			}
+		}
+		
+		sort(events.begin(), events.end());
+		
+		vector<int> exonCounts(transcriptsEnd - transcriptsBegin, 0);
+		vector<int> cdsCounts(transcriptsEnd - transcriptsBegin, 0);
+		
+		// Positions before the first breakpoint are in no exon
+		tables.segmentStart.push_back(numeric_limits<int>::min());
+		tables.segmentLocation.push_back(IntronLocation);
+		
+		size_t eventIndex = 0;
+		while (eventIndex < events.size())
+		{
+			int position = events[eventIndex].position;
+			for (; eventIndex < events.size() && events[eventIndex].position == position; eventIndex++)
+			{
+				exonCounts[events[eventIndex].transcriptIndex] += events[eventIndex].exonDelta;
+				cdsCounts[events[eventIndex].transcriptIndex] += events[eventIndex].cdsDelta;
+			}
+			
+			EGeneLocation location = ClassifyPosition(position, plusStrand, transcriptsBegin, exonCounts, cdsCounts, tables);
+			
+			if (location != tables.segmentLocation.back())
+			{
+				tables.segmentStart.push_back(position);
+				tables.segmentLocation.push_back(location);
+			}
 		}
+		
+		tables.geneSegmentOffsets.push_back(tables.segmentStart.size());
 	}
 	
-	int CalculateGenomicPosition(const string& transcriptID, int position)
+	// Change in a gene's location at a position, or the end of the gene
+	struct CAnnotationEvent
 	{
-		const string& geneID = mTranscriptGene[transcriptID];
-		const CGene& gene = mGenes[geneID];
-		const vector<CRegion>& exons = mExons[transcriptID];
+		int position;
+		uint32_t geneOrdinal;
+		int location;
 		
-		if (gene.strand == "-")
+		bool operator<(const CAnnotationEvent& other) const
 		{
-			position = mTranscriptLength[transcriptID] - position + 1;
+			return position < other.position;
 		}
+	};
+	
+	static bool AnnotationGeneLess(const pair<uint32_t,unsigned char>& annotation, uint32_t geneOrdinal)
+	{
+		return annotation.first < geneOrdinal;
+	}
+	
+	// Merge the location segments of the genes of a chromosome, clipped to
+	// each gene's extent, into annotation segments each listing the genes
+	// overlapping it and their locations
+	static void AddChromosomeAnnotations(const vector<CInterval<uint32_t> >& geneIntervals, CGeneModelTables<CColumn>& tables)
+	{
+		const int endGene = -1;
 		
-		if (position < 1)
+		vector<CAnnotationEvent> events;
+		for (vector<CInterval<uint32_t> >::const_iterator intervalIter = geneIntervals.begin(); intervalIter != geneIntervals.end(); intervalIter++)
 		{
-			return exons.front().start + position - 1;
+			uint32_t geneOrdinal = intervalIter->value;
+			int start = intervalIter->start;
+			int end = intervalIter->stop;
+			
+			uint32_t segmentsBegin = tables.geneSegmentOffsets[geneOrdinal];
+			uint32_t segmentsEnd = tables.geneSegmentOffsets[geneOrdinal + 1];
+			for (uint32_t segmentIndex = segmentsBegin; segmentIndex != segmentsEnd; segmentIndex++)
+			{
+				int segmentStart = max(tables.segmentStart[segmentIndex], start);
+				int segmentEnd = (segmentIndex + 1 == segmentsEnd) ? end : min(tables.segmentStart[segmentIndex + 1] - 1, end);
+				
+				if (segmentStart <= segmentEnd)
+				{
+					events.push_back(CAnnotationEvent{segmentStart, geneOrdinal, tables.segmentLocation[segmentIndex]});
+				}
+			}
+			
+			if (start <= end && end < numeric_limits<int>::max())
+			{
+				events.push_back(CAnnotationEvent{end + 1, geneOrdinal, endGene});
+			}
 		}
 		
-		int localOffset = 0;
-		for (vector<CRegion>::const_iterator exonIter = exons.begin(); exonIter != exons.end(); exonIter++)
+		sort(events.begin(), events.end());
+		
+		// Genes overlapping the current position in gene ordinal order
+		vector<pair<uint32_t,unsigned char> > active;
+		
+		// Positions before the first gene are in no gene
+		tables.annotationStart.push_back(numeric_limits<int>::min());
+		tables.annotationGeneOffsets.push_back(tables.annotationGene.size());
+		
+		size_t eventIndex = 0;
+		while (eventIndex < events.size())
 		{
-			int exonSize = exonIter->end - exonIter->start + 1;
+			int position = events[eventIndex].position;
+			for (; eventIndex < events.size() && events[eventIndex].position == position; eventIndex++)
+			{
+				const CAnnotationEvent& event = events[eventIndex];
+				
+				vector<pair<uint32_t,unsigned char> >::iterator activeIter = lower_bound(active.begin(), active.end(), event.geneOrdinal, AnnotationGeneLess);
+				bool isActive = (activeIter != active.end() && activeIter->first == event.geneOrdinal);
+				
+				if (event.location == endGene)
+				{
+					if (isActive)
+					{
+						active.erase(activeIter);
+					}
+				}
+				else if (isActive)
+				{
+					activeIter->second = event.location;
+				}
+				else
+				{
+					active.insert(activeIter, make_pair(event.geneOrdinal, (unsigned char)event.location));
+				}
+			}
 			
-			if (position <= localOffset + exonSize)
+			// Extend the previous segment if its genes and locations are unchanged
+			size_t previousBegin = tables.annotationGeneOffsets[tables.annotationGeneOffsets.size() - 2];
+			size_t previousEnd = tables.annotationGeneOffsets.back();
+			bool unchanged = (previousEnd - previousBegin == active.size());
+			for (size_t activeIndex = 0; unchanged && activeIndex < active.size(); activeIndex++)
 			{
-				return position - localOffset - 1 + exonIter->start;
+				unchanged = (tables.annotationGene[previousBegin + activeIndex] == active[activeIndex].first &&
+							 tables.annotationLocation[previousBegin + activeIndex] == active[activeIndex].second);
 			}
 			
-			localOffset += exonSize;
+			if (!unchanged)
+			{
+				tables.annotationStart.push_back(position);
+				for (vector<pair<uint32_t,unsigned char> >::const_iterator activeIter = active.begin(); activeIter != active.end(); activeIter++)
+				{
+					tables.annotationGene.push_back(activeIter->first);
+					tables.annotationLocation.push_back(activeIter->second);
+				}
+				tables.annotationGeneOffsets.push_back(tables.annotationGene.size());
+			}
 		}
+	}
+	
+	// Append value to the string pool of tables
+	static uint32_t AddTableString(const string& value, CGeneModelTables<CColumn>& tables)
+	{
+		uint32_t stringRef = tables.stringOffsets.size() - 1;
+		
+		tables.stringData.insert(tables.stringData.end(), value.begin(), value.end());
+		tables.stringOffsets.push_back(tables.stringData.size());
 		
-		return position - localOffset + exons.back().end;
+		return stringRef;
 	}
 	
-	void CalculateGenomicRegions(const string& transcriptID, int start, int end, vector<CRegion>& regions)
+	// Reference to value in the string pool of tables, appending it only if
+	// not previously added with sharedStringRefs
+	static uint32_t AddSharedTableString(const string& value, CGeneModelTables<CColumn>& tables, unordered_map<string,uint32_t>& sharedStringRefs)
 	{
-		const string& geneID = mTranscriptGene[transcriptID];
-		const CGene& gene = mGenes[geneID];
-		const vector<CRegion>& exons = mExons[transcriptID];
-		int transcriptLength = mTranscriptLength[transcriptID];
+		unordered_map<string,uint32_t>::const_iterator stringRefIter = sharedStringRefs.find(value);
 		
-		if (gene.strand == "-")
+		if (stringRefIter != sharedStringRefs.end())
 		{
-			int tmpStart = transcriptLength - end + 1;
-			int tmpEnd = transcriptLength - start + 1;
-			
-			start = tmpStart;
-			end = tmpEnd;
+			return stringRefIter->second;
 		}
 		
-		if (start < 1)
+		uint32_t stringRef = AddTableString(value, tables);
+		sharedStringRefs.insert(make_pair(value, stringRef));
+		
+		return stringRef;
+	}
+	
+	// Index the gene intervals of each chromosome in the tables with the
+	// selected engine.  The flat engine queries the flat trees of the
+	// tables, owned or mapped, so builds nothing.
+	void BuildGeneIntervalTrees()
+	{
+		mGeneIntervalTrees.clear();
+		
+		if (mIntervalEngine == FlatIntervalTreeEngine)
 		{
-			regions.push_back(CRegion(exons.front().start, exons.front().start));
 			return;
 		}
 		
-		if (end > transcriptLength)
+		vector<vector<CInterval<uint32_t> > > chromosomeIntervals(mTables.chromosomeName.size());
+		for (uint32_t geneOrdinal = 0; geneOrdinal < mTables.geneID.size(); geneOrdinal++)
 		{
-			regions.push_back(CRegion(exons.back().end, exons.back().end));
-			return;
+			chromosomeIntervals[mTables.geneChromosome[geneOrdinal]].push_back(CInterval<uint32_t>(mTables.geneStart[geneOrdinal], mTables.geneEnd[geneOrdinal], geneOrdinal));
 		}
 		
-		int localOffset = 0;
-		for (vector<CRegion>::const_iterator exonIter = exons.begin(); exonIter != exons.end(); exonIter++)
+		for (vector<vector<CInterval<uint32_t> > >::iterator intervalsIter = chromosomeIntervals.begin(); intervalsIter != chromosomeIntervals.end(); intervalsIter++)
 		{
-			int localStart = start - localOffset;
-			int localEnd = end - localOffset;
-			
-			int overlapStart = max(1, localStart) + exonIter->start - 1;
-			int overlapEnd = min(exonIter->GetLength(), localEnd) + exonIter->start - 1;
-			
-			if (overlapStart <= overlapEnd)
-			{
-				regions.push_back(CRegion(overlapStart, overlapEnd));
-			}
-			
-			localOffset += exonIter->GetLength();
+			mGeneIntervalTrees.push_back(CIntervalIndex<uint32_t>(*intervalsIter, mIntervalEngine));
 		}
 	}
 	
-private:
-	map<string,CGene> mGenes;
-	map<string,set<string> > mGeneTranscripts;
-	map<string,string> mTranscriptGene;
-	map<string,int> mTranscriptLength;
-	map<string,vector<CRegion> > mExons;
-	map<string,vector<CRegion> > mCDSs;
-	map<string,CRegion> mStartCodon;
-	map<string,CRegion> mStopCodon;
-	map<string,CIntervalTree<string> > mGeneIntervalTrees;
+	// Call query(index) with the gene interval index of a chromosome, the
+	// flat tree of the tables for the flat engine and otherwise the tree
+	// built with the selected engine, returning its result
+	template <class TQuery>
+	auto QueryGeneIntervals(int chromosomeID, TQuery query) const -> decltype(query(declval<const CIntervalIndex<uint32_t>&>()))
+	{
+		if (mIntervalEngine == FlatIntervalTreeEngine)
+		{
+			return query(mTables.GetGeneIntervalTree(chromosomeID));
+		}
+		return query(mGeneIntervalTrees[chromosomeID]);
+	}
+	
+	// Point the tables view at the owned tables
+	void UpdateTables()
+	{
+		CColumnViewBuilder viewBuilder;
+		CGeneModelTables<CColumn>::VisitColumns(mOwnedTables, viewBuilder);
+		CGeneModelTables<CArrayView>::VisitColumns(mTables, viewBuilder);
+	}
+	
+	// Row of a transcript, which must have exons for positions to be mapped
+	uint32_t GetTranscriptRow(const string& transcriptID) const
+	{
+		int transcriptRow = mTables.FindTranscript(transcriptID);
+		
+		if (transcriptRow < 0 || mTables.GetExons(transcriptRow).empty())
+		{
+			stringstream errorStr;
+			errorStr << "Transcript " << transcriptID << " has no exons";
+			throw std::invalid_argument(errorStr.str());
+		}
+		
+		return transcriptRow;
+	}
+	
+	static void ThrowInvalidFile(const string& fileType, const string& filename, const string& reason)
+	{
+		stringstream errorStr;
+		errorStr << "Invalid " << fileType << " file " << filename << ": " << reason;
+		throw std::invalid_argument(errorStr.str());
+	}
+	
+	void AppendGeneIDs(const vector<uint32_t>& geneOrdinals, vector<string>& genes) const
+	{
+		for (vector<uint32_t>::const_iterator geneOrdinalIter = geneOrdinals.begin(); geneOrdinalIter != geneOrdinals.end(); geneOrdinalIter++)
+		{
+			genes.push_back(string(mTables.GetString(mTables.geneID[*geneOrdinalIter])));
+		}
+	}
+	
+	// Signed distance from a position to a gene relative to the gene strand,
+	// negative for genes upstream of the position
+	int GetStrandDistance(uint32_t geneOrdinal, int distance) const
+	{
+		return mTables.GetString(mTables.geneStrand[geneOrdinal]) == "-" ? -distance : distance;
+	}
+	
+	CGeneModels(const CGeneModels&);
+	CGeneModels& operator=(const CGeneModels&);
+	
+	EIntervalEngine mIntervalEngine;
+	
+	// Columnar tables, owned after a gtf or binary load, and otherwise mapped
+	// from an image.  Queries use the view, which addresses either.
+	CGeneModelTables<CColumn> mOwnedTables;
+	shared_ptr<CMappedFile> mImageFile;
+	CGeneModelTables<CArrayView> mTables;
+	
+	// Gene interval trees built from the tables with the selected engine,
+	// empty for the flat engine, which queries the tables' flat trees
+	vector<CIntervalIndex<uint32_t> > mGeneIntervalTrees;
 };
 
 
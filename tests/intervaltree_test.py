@@ -44,6 +44,18 @@ def find_nearest(intervals, position):
         yield interval[0]
 
 
+def signed_distance(interval, position):
+    if position > interval[2]:
+        return interval[2] - position
+    return max(0, interval[1] - position)
+
+
+def find_k_nearest(intervals, position, k, max_distance):
+    nearest = [(interval[0], signed_distance(interval, position)) for interval in intervals]
+    nearest = [a for a in nearest if abs(a[1]) <= max_distance]
+    return sorted(nearest, key=lambda a: (abs(a[1]), a[1], a[0]))[:k]
+
+
 class intervaltree_test(unittest.TestCase):
     
     def setUp(self):
@@ -69,6 +81,13 @@ class intervaltree_test(unittest.TestCase):
         self.assertEqual(contained_ids, set([2]))
         self.assertEqual(nearest_ids, set([1, 2]))
         
+    def test_empty(self):
+        for engine in ('tree', 'flat', 'nclist', 'ailist'):
+            interval_tree = pygenes.IntervalTree([], engine=engine)
+            self.assertEqual(list(interval_tree.find_overlapping(6, 12)), [])
+            self.assertEqual(list(interval_tree.find_contained(6, 12)), [])
+            self.assertEqual(list(interval_tree.find_nearest(7)), [])
+        
     def construct_random_intervals(self, num_intervals, max_start, max_size):
         intervals = list()
         for idx in range(num_intervals):
@@ -104,6 +123,54 @@ class intervaltree_test(unittest.TestCase):
         self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_contained, find_contained)
         self.compare_random_positions(100, 10000, intervals, interval_tree.find_nearest, find_nearest)
         
+    def test_random_flat(self):
+        intervals = self.construct_random_intervals(1000, 1000, 100)
+        interval_tree = pygenes.IntervalTree(intervals, engine='flat')
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_overlapping, find_overlapping)
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_contained, find_contained)
+        self.compare_random_positions(100, 10000, intervals, interval_tree.find_nearest, find_nearest)
+        
+    def test_random_nclist(self):
+        intervals = self.construct_random_intervals(1000, 1000, 100)
+        intervals += [(idx + 1000, start, stop) for idx, start, stop in intervals[:100]]
+        interval_tree = pygenes.IntervalTree(intervals, engine='nclist')
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_overlapping, find_overlapping)
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_contained, find_contained)
+        self.compare_random_positions(100, 10000, intervals, interval_tree.find_nearest, find_nearest)
+        
+    def test_random_ailist(self):
+        intervals = self.construct_random_intervals(1000, 1000, 100)
+        intervals += [(idx + 1000, start, stop + 500) for idx, start, stop in intervals[:100]]
+        interval_tree = pygenes.IntervalTree(intervals, engine='ailist')
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_overlapping, find_overlapping)
+        self.compare_random_intervals(100, 10000, 100, intervals, interval_tree.find_contained, find_contained)
+        self.compare_random_positions(100, 10000, intervals, interval_tree.find_nearest, find_nearest)
+        
+    def test_count(self):
+        intervals = self.construct_random_intervals(1000, 1000, 100)
+        intervals += [(idx + 1000, start, stop + 500) for idx, start, stop in intervals[:100]]
+        for engine in ('tree', 'flat', 'nclist', 'ailist'):
+            interval_tree = pygenes.IntervalTree(intervals, engine=engine)
+            for idx in range(100):
+                start = random.randint(0, 2000)
+                stop = start + random.randint(0, random.choice((10, 100)))
+                num_overlapping = len(list(find_overlapping(intervals, start, stop)))
+                self.assertEqual(interval_tree.count_overlapping(start, stop), num_overlapping)
+                self.assertEqual(interval_tree.count_contained(start, stop), len(list(find_contained(intervals, start, stop))))
+                self.assertEqual(interval_tree.any_overlapping(start, stop), num_overlapping > 0)
+
+    def test_k_nearest(self):
+        intervals = self.construct_random_intervals(1000, 1000, 100)
+        intervals += [(idx + 1000, start, stop + 500) for idx, start, stop in intervals[:100]]
+        for engine in ('tree', 'flat', 'nclist', 'ailist'):
+            interval_tree = pygenes.IntervalTree(intervals, engine=engine)
+            for idx in range(100):
+                position = random.randint(-100, 2100)
+                k = random.randint(0, 20)
+                self.assertEqual(interval_tree.find_k_nearest(position, k), find_k_nearest(intervals, position, k, 1 << 31))
+                self.assertEqual(interval_tree.find_k_nearest(position, k, max_distance=20), find_k_nearest(intervals, position, k, 20))
+        self.assertEqual(pygenes.IntervalTree([]).find_k_nearest(0, 5), [])
+        
         
 if __name__ == '__main__':
     unittest.main()
@@ -1,8 +1,27 @@
 import os
+import gzip
+import concurrent.futures
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
 import unittest
+import zlib
 import pygenes
 
 
+def write_bgzf(filename, data, block_size=4096):
+    with open(filename, 'wb') as f:
+        for offset in range(0, len(data) + 1, block_size):
+            block = data[offset:offset + block_size]
+            compressor = zlib.compressobj(9, zlib.DEFLATED, -15)
+            compressed = compressor.compress(block) + compressor.flush()
+            f.write(struct.pack('<4BI2BH2BHH', 0x1f, 0x8b, 8, 4, 0, 0, 0xff, 6, ord('B'), ord('C'), 2, len(compressed) + 25))
+            f.write(compressed)
+            f.write(struct.pack('<II', zlib.crc32(block) & 0xffffffff, len(block)))
+
+
 class pygenes_test(unittest.TestCase):
     
     def setUp(self):
@@ -47,6 +66,593 @@ class pygenes_test(unittest.TestCase):
         self.assertEqual([(a.start, a.end) for a in gene_models.calculate_genomic_regions('ENST00000320876', 461, 796)],
                          [(2656878, 2657030), (2663280, 2663362), (2664014, 2664113)])
         
+    def test_malformed_lines(self):
+        
+        with open(self.gtf_filename) as f:
+            lines = f.read().splitlines()
+        
+        temp_directory = tempfile.mkdtemp()
+        try:
+            def load(line_index, line, memory_map, num_threads):
+                filename = os.path.join(temp_directory, 'malformed.gtf')
+                with open(filename, 'w') as f:
+                    f.write('\n'.join(lines[:line_index] + [line] + lines[line_index + 1:]) + '\n')
+                gene_models = pygenes.GeneModels()
+                gene_models.load_ensembl_gtf(filename, memory_map=memory_map, num_threads=num_threads)
+                return gene_models
+            
+            expected_gene_models = pygenes.GeneModels()
+            expected_gene_models.load_ensembl_gtf(self.gtf_filename)
+            
+            fields = lines[200].split('\t')
+            bad_start = '\t'.join(fields[:3] + ['abc'] + fields[4:])
+            
+            for memory_map, num_threads in ((False, 1), (True, 1), (True, 3)):
+                with self.assertRaisesRegex(ValueError, r'^Empty gtf line 201 of .*malformed\.gtf$'):
+                    load(200, '', memory_map, num_threads)
+                with self.assertRaisesRegex(ValueError, r'^Error: Format error for gtf line 201 of .*malformed\.gtf$'):
+                    load(200, '\t'.join(fields[:5]), memory_map, num_threads)
+                with self.assertRaisesRegex(ValueError, r'^Field abc could not be cast for gtf line 201 of .*malformed\.gtf$'):
+                    load(200, bad_start, memory_map, num_threads)
+                with self.assertRaisesRegex(ValueError, r'^Field 12x could not be cast for gtf line 3 of '):
+                    load(2, '\t'.join(lines[2].split('\t')[:4] + ['12x'] + lines[2].split('\t')[5:]), memory_map, num_threads)
+                
+                # a leading plus sign is accepted as by stream extraction
+                gene_models = load(200, '\t'.join(fields[:3] + ['+' + fields[3]] + fields[4:]), memory_map, num_threads)
+                self.assertEqual(gene_models.get_num_genes(), expected_gene_models.get_num_genes())
+                
+                # unquoted attribute values are kept whole
+                unquoted = fields[8].replace('"', '').replace('gene_id ', 'gene_id  ')
+                gene_models = load(200, '\t'.join(fields[:8] + [unquoted]), memory_map, num_threads)
+                self.assertEqual(gene_models.get_num_genes(), expected_gene_models.get_num_genes())
+                self.assertEqual(gene_models.get_transcript_gene('ENST00000379033'), 'ENSG00000065665')
+                self.assertEqual(vars(gene_models.get_gene('ENSG00000065665')), vars(expected_gene_models.get_gene('ENSG00000065665')))
+        finally:
+            shutil.rmtree(temp_directory)
+        
+    def test_memory_map(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename, memory_map=True)
+        
+        gene = gene_models.get_gene('ENSG00000101596')
+        self.assertEqual(gene.name, 'SMCHD1')
+        self.assertEqual(gene.start, 2690857)
+        self.assertEqual(gene.end, 2792925)
+        
+        self.assertEqual(set([a for a in gene_models.find_overlapping_genes('18', 2700000, 2800000)]),
+                         set(['ENSG00000101596', 'ENSG00000209536', 'ENSG00000207034']))
+        
+        self.assertEqual(gene_models.calculate_gene_location('ENSG00000101596', 2792681), 'utr3p')
+        self.assertEqual(gene_models.calculate_genomic_position('ENST00000320876', 461), 2656878)
+        
+    def test_parallel_load(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        for memory_map in (False, True):
+            parallel_gene_models = pygenes.GeneModels()
+            parallel_gene_models.load_ensembl_gtf(self.gtf_filename, memory_map=memory_map, num_threads=3)
+            
+            self.assertEqual(parallel_gene_models.get_num_genes(), gene_models.get_num_genes())
+            
+            for gene_ordinal in range(gene_models.get_num_genes()):
+                gene_id = gene_models.get_gene_id(gene_ordinal)
+                gene = gene_models.get_gene(gene_id)
+                parallel_gene = parallel_gene_models.get_gene(gene_id)
+                self.assertEqual(vars(parallel_gene), vars(gene))
+                for position in range(gene.start - 1000, gene.end + 1000, 97):
+                    self.assertEqual(parallel_gene_models.calculate_gene_location(gene_id, position),
+                                     gene_models.calculate_gene_location(gene_id, position))
+            
+            self.assertEqual([(a.start, a.end) for a in parallel_gene_models.calculate_genomic_regions('ENST00000320876', 461, 796)],
+                             [(2656878, 2657030), (2663280, 2663362), (2664014, 2664113)])
+        
+    def test_compressed(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        temp_directory = tempfile.mkdtemp()
+        try:
+            with open(self.gtf_filename, 'rb') as f:
+                gtf_data = f.read()
+            
+            gzip_filename = os.path.join(temp_directory, 'test.gtf.gz')
+            with gzip.open(gzip_filename, 'wb') as f:
+                f.write(gtf_data)
+            
+            bgzf_filename = os.path.join(temp_directory, 'test.bgzf.gtf.gz')
+            write_bgzf(bgzf_filename, gtf_data)
+            
+            for filename in (gzip_filename, bgzf_filename):
+                for memory_map, num_threads in ((False, 1), (True, 1), (True, 3)):
+                    compressed_gene_models = pygenes.GeneModels()
+                    compressed_gene_models.load_ensembl_gtf(filename, memory_map=memory_map, num_threads=num_threads)
+                    
+                    self.assertEqual(compressed_gene_models.get_num_genes(), gene_models.get_num_genes())
+                    self.assertEqual(vars(compressed_gene_models.get_gene('ENSG00000101596')), vars(gene_models.get_gene('ENSG00000101596')))
+                    self.assertEqual(compressed_gene_models.calculate_gene_location('ENSG00000101596', 2792681), 'utr3p')
+            
+            truncated_filename = os.path.join(temp_directory, 'truncated.gtf.gz')
+            with open(gzip_filename, 'rb') as f, open(truncated_filename, 'wb') as g:
+                g.write(f.read()[:-100])
+            
+            with self.assertRaises(ValueError):
+                pygenes.GeneModels().load_ensembl_gtf(truncated_filename)
+            
+            # blocks claiming more than the BGZF maximum contents size fail
+            # cleanly rather than sizing the output from them
+            with open(bgzf_filename, 'rb') as f:
+                bgzf_data = bytearray(f.read())
+            block_offset = 0
+            while block_offset < len(bgzf_data):
+                block_offset += struct.unpack('<H', bgzf_data[block_offset + 16:block_offset + 18])[0] + 1
+                bgzf_data[block_offset - 4:block_offset] = struct.pack('<I', 0xfffffff0)
+            oversized_filename = os.path.join(temp_directory, 'oversized.gtf.gz')
+            with open(oversized_filename, 'wb') as f:
+                f.write(bgzf_data)
+            
+            for memory_map, num_threads in ((False, 1), (True, 3)):
+                with self.assertRaises(ValueError):
+                    pygenes.GeneModels().load_ensembl_gtf(oversized_filename, memory_map=memory_map, num_threads=num_threads)
+        finally:
+            shutil.rmtree(temp_directory)
+        
+    def test_gene_ordinals(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        for gene_ordinal in range(gene_models.get_num_genes()):
+            self.assertEqual(gene_models.get_gene_ordinal(gene_models.get_gene_id(gene_ordinal)), gene_ordinal)
+        
+        self.assertEqual(set([gene_models.get_gene_id(a) for a in gene_models.find_overlapping_gene_ordinals('18', 2700000, 2800000)]),
+                         set(['ENSG00000101596', 'ENSG00000209536', 'ENSG00000207034']))
+        
+        self.assertEqual(set([gene_models.get_gene_id(a) for a in gene_models.find_contained_gene_ordinals('18', 2700000, 2800000)]),
+                         set(['ENSG00000209536', 'ENSG00000207034']))
+        
+        self.assertEqual([gene_models.get_gene_id(a) for a in gene_models.find_nearest_gene_ordinals('18', 2810000)],
+                         ['ENSG00000101596'])
+        
+        with self.assertRaises(ValueError):
+            gene_models.get_gene_ordinal('ENSG00000000000')
+        
+    def test_chromosome_ids(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        self.assertEqual(gene_models.get_num_chromosomes(), 2)
+        self.assertEqual(gene_models.get_chromosome_name(gene_models.get_chromosome_id('18')), '18')
+        self.assertEqual(gene_models.get_chromosome_id('X'), -1)
+        self.assertEqual(list(gene_models.find_overlapping_genes('X', 2700000, 2800000)), [])
+        
+    def test_annotate_position(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        def expected_annotations(chromosome, position, flank):
+            gene_ids = gene_models.find_overlapping_genes(chromosome, position - flank, position + flank)
+            return sorted([(gene_id, gene_models.calculate_gene_location(gene_id, position)) for gene_id in gene_ids],
+                          key=lambda a: gene_models.get_gene_ordinal(a[0]))
+        
+        for position in range(2650000, 2850000, 997):
+            self.assertEqual(gene_models.annotate_position('18', position), expected_annotations('18', position, 0))
+            self.assertEqual(gene_models.annotate_position('18', position, flank=5000), expected_annotations('18', position, 5000))
+        
+        self.assertEqual(gene_models.annotate_position('18', 2767810), [('ENSG00000101596', 'coding')])
+        self.assertEqual(gene_models.annotate_position('X', 2767810), [])
+        
+    def test_gene_location_sweep(self):
+        
+        # Locations of every position around every gene, on both strands,
+        # against runs of locations from the original per query calculation
+        expected = {}
+        with open(os.path.join(os.path.dirname(__file__), 'gene_locations.tsv')) as f:
+            for line in f:
+                if not line.startswith('#'):
+                    gene_id, position, location = line.split()
+                    expected.setdefault(gene_id, []).append((int(position), location))
+        
+        flank = 10
+        strands = set()
+        for gtf_filename in (self.gtf_filename, os.path.join(os.path.dirname(__file__), 'Homo_sapiens.NCBI36.54.minus.test.gtf')):
+            gene_models = pygenes.GeneModels()
+            gene_models.load_ensembl_gtf(gtf_filename)
+            
+            for gene_ordinal in range(gene_models.get_num_genes()):
+                gene = gene_models.get_gene(gene_models.get_gene_id(gene_ordinal))
+                strands.add(gene.strand)
+                
+                positions = range(gene.start - flank, gene.end + flank + 1)
+                codes = gene_models.calculate_gene_locations_batch([gene_ordinal] * len(positions), positions)
+                
+                locations = [pygenes.gene_location_names[a] for a in codes]
+                
+                runs = []
+                for position, location in zip(positions, locations):
+                    if not runs or runs[-1][1] != location:
+                        runs.append((position, location))
+                
+                self.assertEqual(runs, expected.pop(gene.id))
+                
+                # single queries agree at the gene ends
+                for position in (gene.start - 1, gene.start, gene.end, gene.end + 1):
+                    self.assertEqual(gene_models.calculate_gene_location(gene.id, position), locations[position - positions[0]])
+        
+        self.assertEqual(expected, {})
+        self.assertEqual(strands, set(['+', '-']))
+        
+    def test_batch_queries(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        chromosome_ids = [gene_models.get_chromosome_id(a) for a in ('18', '18', 'X', '18')]
+        starts = [2700000, 2810000, 2700000, 2767810]
+        ends = [2800000, 2820000, 2800000, 2767810]
+        
+        offsets, gene_ordinals = gene_models.find_overlapping_gene_ordinals_batch(chromosome_ids, starts, ends)
+        self.assertEqual(len(offsets), 5)
+        for i in range(4):
+            self.assertEqual(list(gene_ordinals[offsets[i]:offsets[i+1]]),
+                             gene_models.find_overlapping_gene_ordinals('18' if chromosome_ids[i] >= 0 else 'X', starts[i], ends[i]))
+        
+        offsets, gene_ordinals = gene_models.find_contained_gene_ordinals_batch(chromosome_ids, starts, ends)
+        self.assertEqual(set(gene_ordinals[offsets[0]:offsets[1]]),
+                         set(gene_models.find_contained_gene_ordinals('18', 2700000, 2800000)))
+        
+        offsets, gene_ordinals = gene_models.find_nearest_gene_ordinals_batch(chromosome_ids, starts)
+        self.assertEqual(list(gene_ordinals[offsets[1]:offsets[2]]), gene_models.find_nearest_gene_ordinals('18', 2810000))
+        self.assertEqual(offsets[3], offsets[2])
+        
+        offsets, gene_ordinals, locations = gene_models.annotate_positions_batch(chromosome_ids, starts, flank=5000)
+        for i, chromosome in enumerate(('18', '18', 'X', '18')):
+            self.assertEqual([(gene_models.get_gene_id(a), pygenes.gene_location_names[b])
+                              for a, b in zip(gene_ordinals[offsets[i]:offsets[i+1]], locations[offsets[i]:offsets[i+1]])],
+                             gene_models.annotate_position(chromosome, starts[i], flank=5000))
+        
+        gene_ordinal = gene_models.get_gene_ordinal('ENSG00000101596')
+        locations = gene_models.calculate_gene_locations_batch([gene_ordinal] * 4, starts)
+        self.assertEqual([pygenes.gene_location_names[a] for a in locations],
+                         [gene_models.calculate_gene_location('ENSG00000101596', a) for a in starts])
+        
+        offsets, gene_ordinals = gene_models.find_overlapping_gene_ordinals_batch([], [], [])
+        self.assertEqual(list(offsets), [0])
+        self.assertEqual(len(gene_ordinals), 0)
+        
+        with self.assertRaises(ValueError):
+            gene_models.find_overlapping_gene_ordinals_batch(chromosome_ids, starts, ends[:2])
+        
+        with self.assertRaises(IndexError):
+            gene_models.calculate_gene_locations_batch([gene_models.get_num_genes()], [0])
+        
+    def test_count_queries(self):
+        
+        for interval_engine in ('tree', 'flat', 'nclist', 'ailist'):
+            gene_models = pygenes.GeneModels(interval_engine=interval_engine)
+            gene_models.load_ensembl_gtf(self.gtf_filename)
+            
+            self.assertEqual(gene_models.count_overlapping_genes('18', 2700000, 2800000), 3)
+            self.assertEqual(gene_models.count_contained_genes('18', 2700000, 2800000), 2)
+            self.assertTrue(gene_models.any_overlapping_genes('18', 2700000, 2800000))
+            self.assertFalse(gene_models.any_overlapping_genes('X', 2700000, 2800000))
+            
+            chromosome_ids = [a % 3 - 1 for a in range(3000)]
+            starts = [2600000 + 97 * a for a in range(3000)]
+            ends = [a + (a % 7) * 2000 for a in starts]
+            chromosomes = [gene_models.get_chromosome_name(a) if a >= 0 else 'X' for a in chromosome_ids]
+            
+            overlapping = [len(gene_models.find_overlapping_genes(*a)) for a in zip(chromosomes, starts, ends)]
+            contained = [len(gene_models.find_contained_genes(*a)) for a in zip(chromosomes, starts, ends)]
+            self.assertEqual([gene_models.count_overlapping_genes(*a) for a in zip(chromosomes, starts, ends)], overlapping)
+            self.assertEqual([gene_models.count_contained_genes(*a) for a in zip(chromosomes, starts, ends)], contained)
+            self.assertEqual([gene_models.any_overlapping_genes(*a) for a in zip(chromosomes, starts, ends)], [a > 0 for a in overlapping])
+            
+            self.assertEqual(list(gene_models.count_overlapping_genes_batch(chromosome_ids, starts, ends, num_threads=2)), overlapping)
+            self.assertEqual(list(gene_models.count_contained_genes_batch(chromosome_ids, starts, ends)), contained)
+            self.assertEqual(list(gene_models.any_overlapping_genes_batch(chromosome_ids, starts, ends)), [a > 0 for a in overlapping])
+            self.assertEqual(len(gene_models.any_overlapping_genes_batch([], [], [])), 0)
+        
+    def test_k_nearest_genes(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        genes = [gene_models.get_gene(gene_models.get_gene_id(a)) for a in range(gene_models.get_num_genes())]
+        
+        def expected_k_nearest(chromosome, position, k, direction, max_distance):
+            nearest = []
+            for gene in genes:
+                if gene.chromosome != chromosome:
+                    continue
+                distance = gene.end - position if position > gene.end else max(0, gene.start - position)
+                if gene.strand == '-':
+                    distance = -distance
+                if abs(distance) > max_distance or (direction == 'upstream' and distance >= 0) or (direction == 'downstream' and distance <= 0):
+                    continue
+                nearest.append((gene.id, distance))
+            nearest.sort(key=lambda a: (abs(a[1]), a[1], gene_models.get_gene_ordinal(a[0])))
+            return nearest[:k]
+        
+        self.assertEqual(gene_models.find_k_nearest_genes('18', 2810000, 1), [('ENSG00000101596', -17075)])
+        self.assertEqual(gene_models.find_k_nearest_genes('18', 2810000, 1, direction='downstream'), [])
+        self.assertEqual(gene_models.find_k_nearest_genes('X', 2810000, 1), [])
+        with self.assertRaises(ValueError):
+            gene_models.find_k_nearest_genes('18', 2810000, 1, direction='sideways')
+        
+        for interval_engine in ('tree', 'flat', 'nclist', 'ailist'):
+            gene_models = pygenes.GeneModels(interval_engine=interval_engine)
+            gene_models.load_ensembl_gtf(self.gtf_filename)
+            for chromosome, positions in (('18', range(2600000, 2900000, 7919)), ('10', range(12150000, 12300000, 3119))):
+                for position in positions:
+                    for direction in ('any', 'upstream', 'downstream'):
+                        for k, max_distance in ((1, None), (5, None), (10, 50000)):
+                            nearest = gene_models.find_k_nearest_genes(chromosome, position, k, direction=direction, max_distance=max_distance)
+                            self.assertEqual(nearest, expected_k_nearest(chromosome, position, k, direction, max_distance or 1 << 31))
+                            self.assertEqual(gene_models.find_k_nearest_gene_ordinals(chromosome, position, k, direction=direction, max_distance=max_distance),
+                                             [(gene_models.get_gene_ordinal(a), b) for a, b in nearest])
+        
+    def test_parallel_batch_queries(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        num_queries = 10000
+        chromosome_ids = [a % 3 - 1 for a in range(num_queries)]
+        positions = [2600000 + 37 * a for a in range(num_queries)]
+        ends = [a + 5000 for a in positions]
+        
+        def batch_results(num_threads):
+            return [
+                [list(a) for a in gene_models.find_overlapping_gene_ordinals_batch(chromosome_ids, positions, ends, num_threads=num_threads)],
+                [list(a) for a in gene_models.find_contained_gene_ordinals_batch(chromosome_ids, positions, ends, num_threads=num_threads)],
+                [list(a) for a in gene_models.find_nearest_gene_ordinals_batch(chromosome_ids, positions, num_threads=num_threads)],
+                [list(a) for a in gene_models.annotate_positions_batch(chromosome_ids, positions, flank=1000, num_threads=num_threads)],
+                list(gene_models.calculate_gene_locations_batch([0] * num_queries, positions, num_threads=num_threads)),
+                list(gene_models.calculate_genomic_positions_batch(['ENST00000320876'] * num_queries, range(num_queries), num_threads=num_threads)),
+            ]
+        
+        expected = batch_results(1)
+        self.assertEqual(expected[5][461], gene_models.calculate_genomic_position('ENST00000320876', 461))
+        for num_threads in (3, 0):
+            self.assertEqual(batch_results(num_threads), expected)
+        
+        transcript_ids = ['ENST00000320876'] * num_queries
+        transcript_ids[5000] = 'ENST00000000000'
+        for num_threads in (1, 4):
+            with self.assertRaises(ValueError):
+                gene_models.calculate_genomic_positions_batch(transcript_ids, [0] * num_queries, num_threads=num_threads)
+        
+    def test_batch_queries_after_fork(self):
+        
+        script = '\n'.join([
+            'import os, sys, pygenes',
+            'gene_models = pygenes.GeneModels()',
+            'gene_models.load_ensembl_gtf(sys.argv[1])',
+            'def batch_results():',
+            '    positions = [2600000 + 37 * a for a in range(10000)]',
+            '    return [list(a) for a in gene_models.find_overlapping_gene_ordinals_batch([a % 3 - 1 for a in range(10000)], positions, [a + 5000 for a in positions], num_threads=4)]',
+            'expected = batch_results()',
+            'pid = os.fork()',
+            'if pid == 0:',
+            '    sys.exit(0 if batch_results() == expected else 1)',
+            'sys.exit(os.waitstatus_to_exitcode(os.waitpid(pid, 0)[1]))',
+        ])
+        
+        env = dict(os.environ, PYTHONPATH=os.path.dirname(os.path.abspath(pygenes.__file__)))
+        result = subprocess.run([sys.executable, '-c', script, self.gtf_filename], env=env, timeout=60)
+        self.assertEqual(result.returncode, 0)
+        
+    def test_join_overlapping(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        chromosome_ids = [(a * 7) % 3 - 1 for a in range(2000)]
+        starts = [2600000 + (a * 7919) % 300000 for a in range(2000)]
+        ends = [a + (a % 50) * 1000 for a in starts]
+        
+        expected = set()
+        offsets, gene_ordinals = gene_models.find_overlapping_gene_ordinals_batch(chromosome_ids, starts, ends)
+        for query_index in range(2000):
+            for gene_ordinal in gene_ordinals[offsets[query_index]:offsets[query_index+1]]:
+                expected.add((query_index, gene_ordinal))
+        self.assertTrue(len(expected) > 0)
+        
+        query_indices, gene_ordinals = gene_models.join_overlapping_gene_ordinals(chromosome_ids, starts, ends)
+        self.assertEqual(len(query_indices), len(expected))
+        self.assertEqual(set(zip(query_indices, gene_ordinals)), expected)
+        
+        order = sorted(range(2000), key=lambda a: (chromosome_ids[a], starts[a]))
+        query_indices, gene_ordinals = gene_models.join_overlapping_gene_ordinals(
+            [chromosome_ids[a] for a in order], [starts[a] for a in order], [ends[a] for a in order])
+        self.assertEqual(set((order[a], b) for a, b in zip(query_indices, gene_ordinals)), expected)
+        
+    def test_concurrent_queries(self):
+        
+        gene_models = pygenes.GeneModels()
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        def query(position):
+            return (list(gene_models.find_overlapping_genes('18', position, position + 10000)),
+                    list(gene_models.find_nearest_genes('18', position)),
+                    gene_models.calculate_gene_location('ENSG00000101596', position),
+                    gene_models.get_gene('ENSG00000101596').name,
+                    gene_models.get_transcript_gene('ENST00000379020'))
+        
+        positions = list(range(2600000, 2900000, 113))
+        expected = [query(a) for a in positions]
+        
+        with concurrent.futures.ThreadPoolExecutor(max_workers=4) as executor:
+            self.assertEqual(list(executor.map(query, positions)), expected)
+        
+        # loading keeps the gil, so queries never see a partially replaced model
+        with concurrent.futures.ThreadPoolExecutor(max_workers=4) as executor:
+            results = executor.map(query, positions)
+            for _ in range(5):
+                gene_models.load_ensembl_gtf(self.gtf_filename)
+            self.assertEqual(list(results), expected)
+        
+    def test_flat_interval_engine(self):
+        
+        gene_models = pygenes.GeneModels(interval_engine='flat')
+        gene_models.load_ensembl_gtf(self.gtf_filename)
+        
+        self.assertEqual(set([a for a in gene_models.find_overlapping_genes('18', 2700000, 2800000)]),
+                         set(['ENSG00000101596', 'ENSG00000209536', 'ENSG00000207034']))
+        
+        self.assertEqual(set([a for a in gene_models.find_contained_genes('18', 2700000, 2800000)]),
+                         set(['ENSG00000209536', 'ENSG00000207034']))
+        
+        self.assertEqual(set([a for a in gene_models.find_nearest_genes('18', 2810000)]),
+                         set(['ENSG00000101596']))
+        
+    def test_binary(self):
+        
+        temp_dir = tempfile.mkdtemp()
+        try:
+            for interval_engine in ('tree', 'flat', 'nclist', 'ailist'):
+                gene_models = pygenes.GeneModels(interval_engine=interval_engine)
+                gene_models.load_ensembl_gtf(self.gtf_filename)
+                
+                binary_filename = os.path.join(temp_dir, 'gene_models.binary')
+                gene_models.save_binary(binary_filename)
+                
+                gene_models2 = pygenes.GeneModels()
+                gene_models2.load_binary(binary_filename)
+                
+                gene = gene_models2.get_gene('ENSG00000101596')
+                self.assertEqual(gene.name, 'SMCHD1')
+                self.assertEqual(gene.start, 2690857)
+                self.assertEqual(gene.end, 2792925)
+                
+                self.assertEqual(gene_models2.get_num_genes(), gene_models.get_num_genes())
+                self.assertEqual(gene_models2.get_num_chromosomes(), gene_models.get_num_chromosomes())
+                self.assertEqual(gene_models2.get_transcript_gene('ENST00000379020'), 'ENSG00000065665')
+                
+                self.assertEqual(set([a for a in gene_models2.find_overlapping_genes('18', 2700000, 2800000)]),
+                                 set(['ENSG00000101596', 'ENSG00000209536', 'ENSG00000207034']))
+                self.assertEqual(gene_models2.find_nearest_gene_ordinals('18', 2810000),
+                                 gene_models.find_nearest_gene_ordinals('18', 2810000))
+                
+                self.assertEqual(gene_models2.calculate_gene_location('ENSG00000101596', 2767810), 'coding')
+                self.assertEqual(gene_models2.calculate_genomic_position('ENST00000320876', 461), 2656878)
+                
+                with open(binary_filename, 'rb') as f:
+                    data = bytearray(f.read())
+                
+                # an out of range engine is rejected even with a valid checksum
+                bad_engine = bytearray(data)
+                bad_engine[32:36] = struct.pack('<i', 7)
+                bad_engine[24:28] = struct.pack('<I', zlib.crc32(bad_engine[32:]) & 0xffffffff)
+                with open(binary_filename, 'wb') as f:
+                    f.write(bad_engine)
+                
+                with self.assertRaisesRegex(ValueError, 'invalid interval engine'):
+                    gene_models2.load_binary(binary_filename)
+                
+                data[len(data) // 2] ^= 0xff
+                with open(binary_filename, 'wb') as f:
+                    f.write(data)
+                
+                with self.assertRaises(ValueError):
+                    gene_models2.load_binary(binary_filename)
+                
+                with open(binary_filename, 'wb') as f:
+                    f.write(data[:len(data) // 2])
+                
+                with self.assertRaises(ValueError):
+                    gene_models2.load_binary(binary_filename)
+                
+                self.assertEqual(gene_models2.get_gene('ENSG00000101596').name, 'SMCHD1')
+        finally:
+            shutil.rmtree(temp_dir)
+        
+    def test_image(self):
+        
+        temp_dir = tempfile.mkdtemp()
+        try:
+            gene_models = pygenes.GeneModels()
+            gene_models.load_ensembl_gtf(self.gtf_filename)
+            
+            image_filename = os.path.join(temp_dir, 'gene_models.image')
+            gene_models.save_image(image_filename)
+            
+            gene_models2 = pygenes.GeneModels()
+            gene_models2.open_image(image_filename)
+            
+            gene = gene_models2.get_gene('ENSG00000101596')
+            self.assertEqual(gene.id, 'ENSG00000101596')
+            self.assertEqual(gene.name, 'SMCHD1')
+            self.assertEqual(gene.source, 'protein_coding')
+            self.assertEqual(gene.chromosome, '18')
+            self.assertEqual(gene.strand, '+')
+            self.assertEqual(gene.start, 2690857)
+            self.assertEqual(gene.end, 2792925)
+            
+            self.assertEqual(gene_models2.get_num_genes(), gene_models.get_num_genes())
+            self.assertEqual(gene_models2.get_gene_id(2), gene_models.get_gene_id(2))
+            self.assertEqual(gene_models2.get_gene_ordinal('ENSG00000101596'), gene_models.get_gene_ordinal('ENSG00000101596'))
+            self.assertEqual(gene_models2.get_chromosome_id('18'), gene_models.get_chromosome_id('18'))
+            self.assertEqual(gene_models2.get_transcript_gene('ENST00000379020'), 'ENSG00000065665')
+            
+            self.assertEqual(set([a for a in gene_models2.find_overlapping_genes('18', 2700000, 2800000)]),
+                             set(['ENSG00000101596', 'ENSG00000209536', 'ENSG00000207034']))
+            self.assertEqual(gene_models2.count_overlapping_genes('18', 2700000, 2800000), 3)
+            self.assertEqual(gene_models2.find_k_nearest_genes('18', 2810000, 2, direction='upstream'),
+                             gene_models.find_k_nearest_genes('18', 2810000, 2, direction='upstream'))
+            self.assertEqual(gene_models2.count_contained_genes('18', 2700000, 2800000), 2)
+            self.assertTrue(gene_models2.any_overlapping_genes('18', 2700000, 2800000))
+            self.assertEqual(set([a for a in gene_models2.find_contained_genes('18', 2700000, 2800000)]),
+                             set(['ENSG00000209536', 'ENSG00000207034']))
+            self.assertEqual(set([a for a in gene_models2.find_nearest_genes('18', 2810000)]),
+                             set(['ENSG00000101596']))
+            
+            for position in (2792681, 2767810, 2767355, 2693692, 2689083, 2805042):
+                self.assertEqual(gene_models2.calculate_gene_location('ENSG00000101596', position),
+                                 gene_models.calculate_gene_location('ENSG00000101596', position))
+            
+            self.assertEqual(gene_models2.calculate_genomic_position('ENST00000320876', 461), 2656878)
+            self.assertEqual([(a.start, a.end) for a in gene_models2.calculate_genomic_regions('ENST00000320876', 461, 796)],
+                             [(2656878, 2657030), (2663280, 2663362), (2664014, 2664113)])
+            
+            # Images opened with other engines query an index built with
+            # that engine from the mapped tables
+            for interval_engine in ('tree', 'flat', 'nclist', 'ailist'):
+                engine_gene_models = pygenes.GeneModels(interval_engine=interval_engine)
+                engine_gene_models.open_image(image_filename)
+                for start in range(2600000, 2900000, 7919):
+                    self.assertEqual(sorted(engine_gene_models.find_overlapping_gene_ordinals('18', start, start + 20000)),
+                                     sorted(gene_models.find_overlapping_gene_ordinals('18', start, start + 20000)))
+                    self.assertEqual(sorted(engine_gene_models.find_nearest_gene_ordinals('18', start)),
+                                     sorted(gene_models.find_nearest_gene_ordinals('18', start)))
+                    self.assertEqual(engine_gene_models.find_k_nearest_gene_ordinals('18', start, 3),
+                                     gene_models.find_k_nearest_gene_ordinals('18', start, 3))
+            
+            # An open image can be saved again unchanged
+            image_filename2 = os.path.join(temp_dir, 'gene_models2.image')
+            gene_models2.save_image(image_filename2)
+            with open(image_filename, 'rb') as f1, open(image_filename2, 'rb') as f2:
+                self.assertEqual(f1.read(), f2.read())
+            
+            # Images must not be modified while mapped, write a truncated copy
+            with open(image_filename, 'rb') as f:
+                data = f.read()
+            truncated_filename = os.path.join(temp_dir, 'truncated.image')
+            with open(truncated_filename, 'wb') as f:
+                f.write(data[:len(data) // 2])
+            
+            with self.assertRaises(ValueError):
+                gene_models2.open_image(truncated_filename)
+            
+            self.assertEqual(gene_models2.get_gene('ENSG00000101596').name, 'SMCHD1')
+        finally:
+            shutil.rmtree(temp_dir)
+        
         
 if __name__ == '__main__':
     unittest.main()